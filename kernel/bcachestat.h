@@ -0,0 +1,8 @@
+// Buffer cache statistics, as returned by bcachestat().
+struct bcachestat {
+  uint64 hits;       // lookups that found the block cached
+  uint64 misses;     // lookups that had to recycle a buffer
+  uint64 nbuf;       // buffers in the cache
+  uint64 maxbuf;     // most buffers the cache may grow to
+  uint64 shrunk;     // buffers given back to kalloc() under pressure
+};
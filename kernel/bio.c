@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,44 +12,201 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The cache starts with NBUF buffers, and grows a page of
+// buffers at a time from kalloc() on misses, up to
+// 1/BCACHEFRAC of physical memory. When kalloc() runs out of
+// pages it calls bshrink() to hand back pages whose buffers
+// are all unused, though never below NBUF buffers. A page
+// holds only the buffers' data, so that it fits PGSIZE/BSIZE
+// of them; their headers are kept in pages of their own, which
+// are reused rather than given back.
+//
+// breadahead() starts reading a block into the cache without
+// waiting for it; the disk interrupt releases the buffer when
+// the read is done. A later bread() of the block finds it
+// cached, or waits for that read rather than starting another.
+// bwrite_async() and bwait() let a caller keep many writes in
+// flight at once. The disk driver merges requests for
+// consecutive blocks, so callers should start a batch of them
+// before waiting for any, and call bflush() after a batch of
+// breadahead()s that no one will wait for right away.
+//
+// Locking: each hash bucket's lock protects its chain, and the
+// refcnt of the buffers on it, so lookups of blocks in different
+// buckets don't contend. bcache.lock protects the LRU list of
+// unused (refcnt 0) buffers, and is taken after a bucket lock.
+// bcache.evict serializes recycling, which needs the locks of
+// two buckets at once: the one the buffer leaves and the one it
+// joins. Only its holder ever holds two bucket locks, and no
+// one waits for it while holding a bucket lock, so this can't
+// deadlock. bcache.evict also protects the list of pages.
 
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcachestat.h"
+
+#define BUFHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUFHASH)
+
+// A kalloc() page of buffer data, and its buffers' headers.
+#define BPERPAGE (PGSIZE / BSIZE)
+struct bpage {
+  struct bpage *next;
+  uchar *data;
+  struct buf buf[BPERPAGE];
+};
+
+extern char end[]; // first address after kernel.
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct spinlock evict;
+  struct bpage *pages;
+  struct bpage *free;  // unused bpages, through next
+  int npages;
+  int minpages;
+  int maxpages;
+  struct bcachestat stat;
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of unused buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  struct {
+    struct spinlock lock;
+    struct buf *chain;   // through hnext
+  } bucket[NBUFHASH];
 } bcache;
 
+// Add a page of buffers to the cache, if it may grow and
+// there is a page to spare. The new buffers are in no bucket
+// until first used, and go at the least recent end of the LRU
+// list so they are used first. Returns 0 on success.
+static int
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+  uchar *data;
+  char *hp;
+
+  if((data = kalloc_noreclaim()) == 0)
+    return -1;
+
+  acquire(&bcache.evict);
+  if(bcache.npages >= bcache.maxpages){
+    release(&bcache.evict);
+    kfree(data);
+    return -1;
+  }
+  if(bcache.free == 0){
+    // a page of headers for the next few pages of data.
+    if((hp = kalloc_noreclaim()) == 0){
+      release(&bcache.evict);
+      kfree(data);
+      return -1;
+    }
+    for(pg = (struct bpage*)hp; pg + 1 <= (struct bpage*)(hp + PGSIZE); pg++){
+      pg->next = bcache.free;
+      bcache.free = pg;
+    }
+  }
+  pg = bcache.free;
+  bcache.free = pg->next;
+  memset(pg, 0, sizeof(*pg));
+  pg->data = data;
+  for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->data = data + (b - pg->buf) * BSIZE;
+  }
+
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.npages++;
+  acquire(&bcache.lock);
+  for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  release(&bcache.lock);
+  release(&bcache.evict);
+  return 0;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  int i;
+
+  if(sizeof(struct bpage) > PGSIZE)
+    panic("binit: bpage");
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evict, "bcache.evict");
+  for(i = 0; i < NBUFHASH; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  bcache.minpages = (NBUF + BPERPAGE - 1) / BPERPAGE;
+  bcache.maxpages = (PHYSTOP - (uint64)end) / PGSIZE / BCACHEFRAC;
+  if(bcache.maxpages < bcache.minpages)
+    bcache.maxpages = bcache.minpages;
+  for(i = 0; i < bcache.minpages; i++)
+    if(bgrow() < 0)
+      panic("binit");
+}
+
+// Take b off the LRU list. Caller holds its bucket's lock.
+static void
+lru_remove(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  release(&bcache.lock);
+}
+
+// Put the newly unused b at the most recent end of the LRU
+// list. Caller holds its bucket's lock.
+static void
+lru_add(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  release(&bcache.lock);
+}
+
+// Find the block in bucket h, and take a reference to it.
+// Caller holds the bucket's lock.
+static struct buf*
+bucket_find(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].chain; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(b->refcnt++ == 0)
+        lru_remove(b);
+      return b;
+    }
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,34 +215,81 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct buf *b, **pp;
+  int h = BUFHASH(dev, blockno), g;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.bucket[h].lock);
+  b = bucket_find(h, dev, blockno);
+  release(&bcache.bucket[h].lock);
+  if(b){
+    __atomic_fetch_add(&bcache.stat.hits, 1, __ATOMIC_RELAXED);
+    // b's holder may be waiting for a queued disk request.
+    if(b->lock.locked)
+      virtio_disk_kick();
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Rather than recycle a cached block, grow the cache if we
+  // may. bgrow() takes bcache.evict itself, and so does
+  // kalloc() if it has to shrink the cache.
+  if(bcache.npages < bcache.maxpages)
+    bgrow();
+
+  // Not cached. Check again once no one else can be adding
+  // blocks, in case someone added this one meanwhile.
+  acquire(&bcache.evict);
+  acquire(&bcache.bucket[h].lock);
+  if((b = bucket_find(h, dev, blockno)) != 0){
+    release(&bcache.bucket[h].lock);
+    release(&bcache.evict);
+    __atomic_fetch_add(&bcache.stat.hits, 1, __ATOMIC_RELAXED);
+    if(b->lock.locked)
+      virtio_disk_kick();
+    acquiresleep(&b->lock);
+    return b;
   }
+  __atomic_fetch_add(&bcache.stat.misses, 1, __ATOMIC_RELAXED);
 
-  // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Its bucket lock must be taken before bcache.lock, so
+  // check that it is still unused once holding that.
+  for(;;){
+    acquire(&bcache.lock);
+    b = bcache.head.prev;
+    release(&bcache.lock);
+    if(b == &bcache.head)
+      panic("bget: no buffers");
+    g = BUFHASH(b->dev, b->blockno);
+    if(g != h)
+      acquire(&bcache.bucket[g].lock);
+    if(b->refcnt == 0)
+      break;
+    if(g != h)
+      release(&bcache.bucket[g].lock);
+  }
+
+  lru_remove(b);
+  for(pp = &bcache.bucket[g].chain; *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
     }
   }
-  panic("bget: no buffers");
+  if(g != h)
+    release(&bcache.bucket[g].lock);
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->hnext = bcache.bucket[h].chain;
+  bcache.bucket[h].chain = b;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.evict);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +306,65 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// brelse(), without checking who holds b; for the disk
+// interrupt.
+static void
+bunlock(struct buf *b)
+{
+  int h = BUFHASH(b->dev, b->blockno);
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.bucket[h].lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    lru_add(b);
+  }
+  release(&bcache.bucket[h].lock);
+}
+
+// Is the block cached? A hint; the answer may be stale.
+static int
+bcached(uint dev, uint blockno)
+{
+  struct buf *b;
+  int h = BUFHASH(dev, blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  for(b = bcache.bucket[h].chain; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bcache.bucket[h].lock);
+  return b != 0;
+}
+
+// Disk interrupt: a breadahead() read has finished.
+static void
+breadahead_done(struct buf *b)
+{
+  b->valid = 1;
+  b->iodone = 0;
+  bunlock(b);
+}
+
+// Start reading the block into the cache, without waiting.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if(bcached(dev, blockno))
+    return;
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  b->iodone = breadahead_done;
+  virtio_disk_submit(b, 0);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,6 +375,31 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk. Must be locked, and
+// stay locked until bwait(b).
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+
+  virtio_disk_submit(b, 1);
+}
+
+// Wait for bwrite_async(b) to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
+// Send queued requests to the disk without waiting for them.
+void
+bflush(void)
+{
+  virtio_disk_kick();
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
@@ -120,35 +408,114 @@ brelse(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bunlock(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BUFHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  int h = BUFHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  if(--b->refcnt == 0)
+    lru_add(b);
+  release(&bcache.bucket[h].lock);
 }
 
+// Take the unused buffer b out of its bucket, so that no one
+// can find it. Returns 0 if b is in use. Caller holds
+// bcache.evict.
+static int
+bunhash(struct buf *b)
+{
+  struct buf **pp;
+  int g = BUFHASH(b->dev, b->blockno);
 
+  acquire(&bcache.bucket[g].lock);
+  if(b->refcnt != 0){
+    release(&bcache.bucket[g].lock);
+    return -1;
+  }
+  for(pp = &bcache.bucket[g].chain; *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
+    }
+  }
+  b->dev = 0;
+  b->blockno = 0;
+  b->valid = 0;
+  release(&bcache.bucket[g].lock);
+  return 0;
+}
+
+// kalloc() has run out of pages: give back up to n pages of
+// unused buffers. Returns how many pages were freed.
+int
+bshrink(int n)
+{
+  struct bpage **pp, *pg;
+  struct buf *b;
+  uchar *data, *freed = 0;
+  int nfreed = 0;
+
+  acquire(&bcache.evict);
+  for(pp = &bcache.pages; *pp && nfreed < n && bcache.npages > bcache.minpages; ){
+    pg = *pp;
+    // Buffers unhashed before finding a busy one stay on the
+    // LRU list, and will be recycled first.
+    for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++)
+      if(bunhash(b) < 0)
+        break;
+    if(b < &pg->buf[BPERPAGE]){
+      pp = &pg->next;
+      continue;
+    }
+    // Only the holder of bcache.evict takes unhashed buffers
+    // off the LRU list, so they stay unused.
+    acquire(&bcache.lock);
+    for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+      b->next->prev = b->prev;
+      b->prev->next = b->next;
+    }
+    release(&bcache.lock);
+    *pp = pg->next;
+    bcache.npages--;
+    // the header can be reused at once; the data page goes back
+    // to kalloc() once bcache.evict is released, linked through
+    // its first word until then.
+    *(uchar**)pg->data = freed;
+    freed = pg->data;
+    pg->next = bcache.free;
+    bcache.free = pg;
+    nfreed++;
+  }
+  release(&bcache.evict);
+
+  __atomic_fetch_add(&bcache.stat.shrunk, nfreed * BPERPAGE, __ATOMIC_RELAXED);
+  while((data = freed) != 0){
+    freed = *(uchar**)data;
+    kfree(data);
+  }
+  return nfreed;
+}
+
+// Copy the cache's statistics to the user address addr.
+int
+bcachestat(uint64 addr)
+{
+  struct bcachestat s;
+
+  s = bcache.stat;
+  s.nbuf = bcache.npages * BPERPAGE;
+  s.maxbuf = bcache.maxpages * BPERPAGE;
+  return copyout(myproc()->pagetable, addr, (char *)&s, sizeof(s));
+}
@@ -1,12 +1,16 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  void (*iodone)(struct buf*); // if set, called when the disk is done
+  int qwrite;  // queued for the disk to write, not read?
+  struct buf *qnext; // disk request queue
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *hnext; // hash bucket chain
+  struct buf *prev; // LRU list of unused buffers
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data; // BSIZE bytes, in a page shared with BPERPAGE-1 others
 };
 
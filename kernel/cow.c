@@ -3,12 +3,15 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 #include <stdbool.h>
 
-struct spinlock cow_lock;
+// Protects cow_group[]. Page faults look groups up far more
+// often than fork() and exit() change them, so lookups share it.
+struct rwlock cow_lock;
 
 // Max number of pages a CoW group of processes can share
 #define SHMEM_MAX 100
@@ -21,7 +24,8 @@ struct cow_group {
 
 struct cow_group cow_group[NPROC];
 
-struct cow_group* get_cow_group(int group) {
+// Caller holds cow_lock.
+static struct cow_group* get_cow_group(int group) {
     if(group == -1)
         return 0;
 
@@ -33,52 +37,70 @@ struct cow_group* get_cow_group(int group) {
 }
 
 void cow_group_init(int groupno) {
+    acquirewrite(&cow_lock);
     for(int i = 0; i < NPROC; i++) {
         if(cow_group[i].group == -1) {
             cow_group[i].group = groupno;
-            return;
+            break;
         }
     }
+    releasewrite(&cow_lock);
 } 
 
 int get_cow_group_count(int group) {
-    return get_cow_group(group)->count;
+    acquireread(&cow_lock);
+    int count = get_cow_group(group)->count;
+    releaseread(&cow_lock);
+    return count;
 }
 void incr_cow_group_count(int group) {
-    get_cow_group(group)->count = get_cow_group_count(group)+1;
+    acquirewrite(&cow_lock);
+    get_cow_group(group)->count++;
+    releasewrite(&cow_lock);
 }
 void decr_cow_group_count(int group) {
-    get_cow_group(group)->count = get_cow_group_count(group)-1;
+    acquirewrite(&cow_lock);
+    get_cow_group(group)->count--;
+    releasewrite(&cow_lock);
 }
 
 void add_shmem(int group, uint64 pa) {
     if(group == -1)
         return;
 
+    acquirewrite(&cow_lock);
     uint64 *shmem = get_cow_group(group)->shmem;
     int index;
     for(index = 0; index < SHMEM_MAX; index++) {
         // duplicate address
         if(shmem[index] == pa)
-            return;
-        if(shmem[index] == 0)
             break;
+        if(shmem[index] == 0) {
+            shmem[index] = pa;
+            break;
+        }
     }
-    shmem[index] = pa;
+    releasewrite(&cow_lock);
 }
 
 int is_shmem(int group, uint64 pa) {
+    int r = 0;
+
     if(group == -1)
         return 0;
 
+    acquireread(&cow_lock);
     uint64 *shmem = get_cow_group(group)->shmem;
     for(int i = 0; i < SHMEM_MAX; i++) {
         if(shmem[i] == 0)
-            return 0;
-        if(shmem[i] == pa)
-            return 1;
+            break;
+        if(shmem[i] == pa) {
+            r = 1;
+            break;
+        }
     }
-    return 0;
+    releaseread(&cow_lock);
+    return r;
 }
 
 void cow_init() {
@@ -88,12 +110,12 @@ void cow_init() {
         for(int j = 0; j < SHMEM_MAX; j++)
             cow_group[i].shmem[j] = 0;
     }
-    initlock(&cow_lock, "cow_lock");
+    initrwlock(&cow_lock, "cow_lock");
 }
 
 int uvmcopy_cow(pagetable_t old, pagetable_t new, uint64 sz) {
     /* CSE 536: (2.6.1) Handling Copy-on-write fork() */
-    struct proc* p = myproc();
+    struct proc* p = myproc()->leader;
     // Copy user vitual memory from old(parent) to new(child) process
     
     pte_t *pte;
@@ -104,10 +126,9 @@ int uvmcopy_cow(pagetable_t old, pagetable_t new, uint64 sz) {
   }
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    // skip on-demand pages that aren't loaded.
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
     // clear PTE_W in the PTEs of both child and parent*
@@ -135,10 +156,10 @@ err:
     return -1;
 }
 
-void copy_on_write() {
+void copy_on_write(uint64 va) {
     /* CSE 536: (2.6.2) Handling Copy-on-write */
-    struct proc* p = myproc();
-    uint64 required_address = PGROUNDDOWN(r_stval());
+    struct proc* p = myproc()->leader;
+    uint64 required_address = PGROUNDDOWN(va);
     pte_t *pte;
     pte = walk(p->pagetable, required_address, 0);
     if (pte == 0) {
@@ -156,7 +177,7 @@ void copy_on_write() {
     // Copy contents from the shared page to the new page
     memmove(mem, (char*)pa, PGSIZE);
  
-    uvmunmap(p->pagetable, required_address, 1, get_cow_group(p->cow_group)->count == 1 ? 1 : 0);
+    uvmunmap(p->pagetable, required_address, 1, get_cow_group_count(p->cow_group) == 1 ? 1 : 0);
     //remove from shmem
 
     // Map the new page in the faulting process's page table with write permissions
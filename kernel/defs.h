@@ -2,12 +2,18 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct rwlock;
+struct seqlock;
+struct lockstat;
 struct pipe;
+struct readahead;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct tlbgather;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -16,6 +22,12 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+void            breadahead(uint, uint);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
+void            bflush(void);
+int             bcachestat(uint64);
 
 // console.c
 void            consoleinit(void);
@@ -49,18 +61,30 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
-int             readi(struct inode*, int, uint64, uint, uint);
+int             readi(struct inode*, struct readahead*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+uint            bmap(struct inode*, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// ipi.c
+void            ipiinit(void);
+void            ipisend(int, uint);
+void            ipiintr(void);
+void            tlb_shootdown(pagetable_t, uint64*, int);
+void            tlb_gather_init(struct tlbgather*, pagetable_t);
+void            tlb_gather_add(struct tlbgather*, uint64);
+void            tlb_gather_free(struct tlbgather*, void*);
+void            tlb_gather_flush(struct tlbgather*);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_noreclaim(void);
 void            kfree(void *);
 void            kinit(void);
 
@@ -69,6 +93,35 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+uint            log_tid(void);
+void            log_force(uint);
+
+// mmap.c
+struct vma*     vma_lookup(struct proc*, uint64);
+int             vma_perm(struct vma*);
+int             vma_access(struct vma*, uint64);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             msync(uint64, uint64);
+int             mmap_fault(struct proc*, struct vma*, uint64, int);
+int             mmap_fill(struct vma*, uint64, char*);
+int             vma_copy(struct proc*, struct proc*, int);
+void            vma_free(struct proc*);
+
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, uint, int);
+int             futex_wake(uint64, int);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_dup(struct inode*, char*);
+void            pcache_put(struct inode*, char*);
+int             pcache_writeback(struct inode*, uint, char*);
+void            pcache_update(struct inode*, uint, char*, uint);
+void            pcache_trunc(struct inode*);
+void            pcache_drop(struct inode*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -102,7 +155,23 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeup_n(void*, int);
+void            wakeup_proc(struct proc*, void*);
+int             sleep_timeout(void*, struct spinlock*, int);
 void            yield(void);
+void            runq_add(struct proc*);
+int             sched_tick(void);
+int             setpriority(int, int);
+int             getpriority(int);
+int             setaffinity(int, uint);
+int             getaffinity(int);
+void            mm_lock(struct proc*);
+void            mm_unlock(struct proc*);
+int             mm_holding(struct proc*);
+int             mm_trylock(struct proc*);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             kthread_create(void (*)(void *), void *, char *);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -110,6 +179,12 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// lockstat.c
+struct lockstat* lockstat_find(char*);
+void            lockstat_acquired(struct lockstat*, int, uint64);
+void            lockstat_released(struct lockstat*, uint64);
+int             getlockstat(uint64, int);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -118,6 +193,18 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+void            initseqlock(struct seqlock*, char*);
+uint            read_seqbegin(struct seqlock*);
+int             read_seqretry(struct seqlock*, uint);
+void            write_seqbegin(struct seqlock*);
+void            write_seqend(struct seqlock*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -143,6 +230,11 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+uint            readticks(void);
+void            timer_add(struct proc*, uint, void*);
+void            timer_del(struct proc*);
+void            tick_stop(void);
+void            tick_start(void);
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -172,8 +264,6 @@ void            cow_init();
 
 void            cow_group_init(int groupno);
 
-struct cow_group* get_cow_group(int group);
-
 int             get_cow_group_count(int group);
 
 void            incr_cow_group_count(int group);
@@ -181,6 +271,7 @@ void            incr_cow_group_count(int group);
 void            decr_cow_group_count(int group);
 
 int             is_shmem(int group, uint64 pa);
+void            add_shmem(int group, uint64 pa);
 void            uvmfree(pagetable_t, uint64);
 
 void            uvmfree_cow(pagetable_t , uint64, int);
@@ -192,7 +283,7 @@ int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
-void            copy_on_write();
+void            copy_on_write(uint64);
 void            uvminvalid(pagetable_t pagetable, uint64 va); // CSE 536
 
 // plic.c
@@ -204,12 +295,27 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_kick(void);
 void            virtio_disk_intr(void);
 
 // CSE 536: pfault.c
 extern uint64   non_fault_addr;
 void            page_fault_handler(void);
 void            proc_pswap_diskblocks_init(void);
+void            init_psa_regions(void);
+int             psa_alloc(void);
+void            psa_free(int);
+int             heap_find(struct proc*, uint64);
+int             heap_track(struct proc*, uint64);
+void            heap_untrack(struct proc*, int);
+void            heap_shrink(struct proc*, uint64, uint64);
+void            heap_release(struct proc*);
+int             heap_copy(struct proc*, struct proc*);
+int             heap_page_in(struct proc*, int, struct vma*);
+int             madvise(uint64, uint64, int);
+uint64          vmfault(pagetable_t, uint64, int);
 
 // CSE 536: debug.h
 void print_static_proc(char* name);
@@ -6,6 +6,10 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
 // static 
 int loadseg(pde_t *, uint64, struct inode *, uint, uint);
@@ -34,6 +38,12 @@ exec(char *path, char **argv)
   char cow1[] = "test8-cow1";
   char cow2[] = "test9-cow2";
   char cow3[] = "test10-cow3"; 
+
+  // the new image would replace the address space
+  // out from under the caller's other threads.
+  if(p->leader != p || p->tslots != 1)
+    return -1;
+
   /* CSE 536: (2.1) Check on-demand status. */
   if(p->pid > 2) {
     p->ondemand = true;
@@ -54,7 +64,7 @@ exec(char *path, char **argv)
 
   // Check ELF header
 
-  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
+  if(readi(ip, 0, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
     goto bad;
 
   if(elf.magic != ELF_MAGIC)
@@ -62,10 +72,9 @@ exec(char *path, char **argv)
 
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
-  cow_init();
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+    if(readi(ip, 0, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
     if(ph.type != ELF_PROG_LOAD)
       continue;
@@ -139,6 +148,7 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
   // Commit to the user image.
+  vma_free(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
@@ -147,11 +157,13 @@ exec(char *path, char **argv)
   proc_freepagetable(oldpagetable, oldsz);
 
   // CSE 536: Clear all heap track regions
+  heap_release(p);
   for (int i = 0; i < MAXHEAP; i++) {
     p->heap_tracker[i].addr            = 0xFFFFFFFFFFFFFFFF;
-    p->heap_tracker[i].startblock      = 0;
+    p->heap_tracker[i].startblock      = -1;
     p->heap_tracker[i].last_load_time  = 0xFFFFFFFFFFFFFFFF;
     p->heap_tracker[i].loaded          = false;
+    p->heap_tracker[i].advice          = MADV_NORMAL;
   }
   p->resident_heap_pages = 0;
 
@@ -177,6 +189,8 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
 {
   uint i, n;
   uint64 pa;
+  struct readahead ra = { 0 };
+
   for(i = 0; i < sz; i += PGSIZE){
     pa = walkaddr(pagetable, va + i);
     if(pa == 0)
@@ -185,7 +199,7 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
       n = sz - i;
     else
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+    if(readi(ip, &ra, 0, (uint64)pa, offset+i, n) != n)
       return -1;
   }
   
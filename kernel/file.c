@@ -106,8 +106,9 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, m, n1;
   struct proc *pr = myproc();
+  char *buf;
   pte_t *pte;
   if((pte = walk(pr->pagetable, PGROUNDDOWN(addr), 0)) == 0)
       panic("uvmcopy: pte should exist");
@@ -127,13 +128,36 @@ fileread(struct file *f, uint64 addr, int n)
     if(pr->ondemand) {
       if(shouldLoad){
       w_stval(addr);
+      mm_lock(pr);
       page_fault_handler();
+      mm_unlock(pr);
       }
     }
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // copy out a page at a time from a kernel buffer, after
+    // iunlock(): faulting the user page in may need mm_lock(),
+    // which comes before inode locks.
+    if((buf = kalloc()) == 0)
+      return -1;
+    while(r < n){
+      n1 = n - r;
+      if(n1 > PGSIZE)
+        n1 = PGSIZE;
+      ilock(f->ip);
+      if((m = readi(f->ip, &f->ra, 0, (uint64)buf, f->off, n1)) > 0)
+        f->off += m;
+      iunlock(f->ip);
+      if(m <= 0)
+        break;
+      if(copyout(pr->pagetable, addr + r, buf, m) < 0){
+        if(r == 0)
+          r = -1;
+        break;
+      }
+      r += m;
+      if(m < n1)
+        break;
+    }
+    kfree(buf);
   } else {
     panic("fileread");
   }
@@ -147,6 +171,7 @@ int
 filewrite(struct file *f, uint64 addr, int n)
 {
   int r, ret = 0;
+  char *buf;
 
   if(f->writable == 0)
     return -1;
@@ -164,16 +189,25 @@ filewrite(struct file *f, uint64 addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
+    // the data is copied in first, through a kernel buffer,
+    // since faulting the user page in may need mm_lock(),
+    // which comes before the log and inode locks.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    if(max > PGSIZE)
+      max = PGSIZE;
+    if((buf = kalloc()) == 0)
+      return -1;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      if(copyin(myproc()->pagetable, buf, addr + i, n1) < 0)
+        break;
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, 0, (uint64)buf, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -184,6 +218,7 @@ filewrite(struct file *f, uint64 addr, int n)
       }
       i += r;
     }
+    kfree(buf);
     ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
@@ -1,3 +1,10 @@
+// Sequential readahead state of a reader, for readi().
+struct readahead {
+  uint off;           // where the last read ended
+  uint end;           // first block not yet read ahead
+  uint win;           // readahead window, in blocks
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
   int ref; // reference count
@@ -6,6 +13,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct readahead ra; // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +26,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct cpage *pages; // mmap()ed pages; protected by pcache.lock
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +36,16 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  uint tid;           // last log transaction to change the inode, for fsync()
+};
+
+// a page of a file, cached for mmap().
+struct cpage {
+  struct inode *ip;   // 0 if unused
+  uint pgoff;         // offset in the file, in pages
+  int ref;            // # of mappings of this page
+  char *pa;           // the page
+  struct cpage *next; // next page of ip
 };
 
 // map major device number to device functions.
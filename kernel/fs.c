@@ -238,6 +238,7 @@ iupdate(struct inode *ip)
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  ip->tid = log_tid();
 }
 
 // Find the inode with number inum on device dev
@@ -271,6 +272,9 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  // changes made before the inode was last in the table may
+  // not be committed yet.
+  ip->tid = log_tid();
   release(&itable.lock);
 
   return ip;
@@ -358,6 +362,8 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0 && ip->pages)
+    pcache_drop(ip);
   release(&itable.lock);
 }
 
@@ -379,7 +385,7 @@ iunlockput(struct inode *ip)
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 // returns 0 if out of disk space.
-static uint
+uint
 bmap(struct inode *ip, uint bn)
 {
   uint addr, *a;
@@ -450,6 +456,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcache_trunc(ip);
 }
 
 // Copy stat information from inode.
@@ -464,12 +471,56 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading blocks of ip that a read of n bytes at off
+// will soon want. For a reader with state ra, such as an open
+// file, a read that starts where its last one ended is
+// sequential, and doubles the readahead window past its end
+// (up to RAMAX blocks); any other read closes it. The blocks
+// of the read itself after the first are always read ahead,
+// so that they are read in parallel rather than one by one.
+// Directories are read a dirent at a time, from cached blocks.
+// Caller holds ip->lock.
+static void
+readahead(struct inode *ip, struct readahead *ra, uint off, uint n)
+{
+  uint b, first, start, end, addr, win = 0, raend = 0;
+
+  if(n == 0 || ip->type == T_DIR)
+    return;
+  if(ra){
+    if(off == ra->off){
+      ra->win = ra->win ? min(2*ra->win, RAMAX) : 4;
+    } else {
+      ra->win = 0;
+      ra->end = 0;
+    }
+    ra->off = off + n;
+    win = ra->win;
+    raend = ra->end;
+  }
+
+  first = off / BSIZE;
+  end = min((off + n - 1) / BSIZE + 1 + win,
+            (ip->size + BSIZE - 1) / BSIZE);
+  start = raend > first ? raend : first + 1;
+  for(b = start; b < end; b++){
+    if((addr = bmap(ip, b)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  if(b > start)
+    bflush();
+  if(ra && end > ra->end)
+    ra->end = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// ra is the reader's readahead state, or 0.
 int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+readi(struct inode *ip, struct readahead *ra, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
@@ -478,6 +529,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  readahead(ip, ra, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -524,6 +576,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    if(ip->pages)
+      pcache_update(ip, off, (char*)bp->data + (off % BSIZE), m);
     brelse(bp);
   }
 
@@ -558,7 +612,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
     panic("dirlookup not DIR");
 
   for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    if(readi(dp, 0, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
       continue;
@@ -591,7 +645,7 @@ dirlink(struct inode *dp, char *name, uint inum)
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    if(readi(dp, 0, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
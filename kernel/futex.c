@@ -0,0 +1,116 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) goes to sleep only if the word at addr
+// still holds val, and futex_wake(addr, n) wakes up to n of the
+// processes sleeping on it. Both are keyed by the word's
+// physical address, so they work between threads and between
+// processes that share the page, e.g. with MAP_SHARED.
+//
+// Sleepers go on the wait queues that sleep() and wakeup() hash
+// channels to. A futex lock, hashed from the address the same
+// way, makes checking the word and going to sleep atomic with
+// respect to futex_wake(). A heap page that is paged out while
+// someone sleeps on it leaves them to a timeout or a spurious
+// wakeup, as callers of futex_wait() must loop anyway.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct spinlock futexlock[NWAITQ];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+static struct spinlock*
+futex_lock(uint64 pa)
+{
+  return &futexlock[(pa >> 3) % NWAITQ];
+}
+
+// Physical address of the word at user address addr,
+// paging it in if need be, or 0 if there is none.
+// Caller holds mm_lock().
+static uint64
+futex_pa(uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+  uint v;
+
+  if(addr % sizeof(uint) != 0)
+    return 0;
+  if(copyin(p->pagetable, (char *)&v, addr, sizeof(v)) < 0)
+    return 0;
+  if((pa = walkaddr(p->pagetable, addr)) == 0)
+    return 0;
+  return pa + (addr % PGSIZE);
+}
+
+// Sleep until futex_wake(addr), if the word at addr holds val,
+// for at most timeout ticks unless timeout is 0.
+// Returns 0 when woken, or -1 if the word didn't hold val,
+// the time ran out, or the caller was killed.
+int
+futex_wait(uint64 addr, uint val, int timeout)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+  int r = 0;
+
+  mm_lock(p);
+  if((pa = futex_pa(addr)) == 0){
+    mm_unlock(p);
+    return -1;
+  }
+  lk = futex_lock(pa);
+  acquire(lk);
+
+  // check the word while mm_lock() still keeps its page from
+  // being paged out or unmapped.
+  if(*(volatile uint *)pa != val || killed(p)){
+    release(lk);
+    mm_unlock(p);
+    return -1;
+  }
+  mm_unlock(p);
+  if(timeout > 0)
+    r = sleep_timeout((void *)pa, lk, timeout);
+  else
+    sleep((void *)pa, lk);
+  release(lk);
+  return r;
+}
+
+// Wake up at most n processes sleeping in futex_wait(addr).
+// Returns the number woken, or -1.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+  int r;
+
+  mm_lock(p);
+  if((pa = futex_pa(addr)) == 0){
+    mm_unlock(p);
+    return -1;
+  }
+  lk = futex_lock(pa);
+  acquire(lk);
+  mm_unlock(p);
+
+  r = wakeup_n((void *)pa, n);
+  release(lk);
+  return r;
+}
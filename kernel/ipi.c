@@ -0,0 +1,174 @@
+// Inter-processor interrupts and TLB shootdown.
+//
+// A hart interrupts another by writing the target's CLINT MSIP
+// register. timervec in kernelvec.S turns the resulting machine
+// software interrupt into a supervisor software interrupt, and
+// devintr() calls ipiintr() to carry out whatever was asked of
+// it in cpu->ipi.
+//
+// When a PTE is removed or write-protected, other harts that
+// are running in the same address space may still hold the old
+// translation in their TLBs. tlb_shootdown() interrupts exactly
+// those harts (cpu->upagetable says which address space each hart
+// has loaded) and waits for them to flush. Callers that change
+// many PTEs collect them in a struct tlbgather so that a single
+// IPI covers the whole batch.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// The shootdown currently in progress. Only one at a time;
+// the sender holds the lock until every target has flushed,
+// so targets can read the fields without locking.
+struct {
+  struct spinlock lock;
+  pagetable_t pagetable;
+  int n;                  // # of entries in va[], or -1 for all
+  uint64 va[TLBBATCH];
+} shootdown;
+
+void
+ipiinit(void)
+{
+  initlock(&shootdown.lock, "shootdown");
+}
+
+// Ask hart to handle the IPI_* requests in why.
+void
+ipisend(int hart, uint why)
+{
+  __sync_fetch_and_or(&cpus[hart].ipi, why);
+  __sync_synchronize();
+  *(volatile uint32*)CLINT_MSIP(hart) = 1;
+}
+
+// Flush this hart's TLB entries for n addresses in pagetable,
+// or all entries if n < 0.
+static void
+tlb_flush(uint64 *va, int n)
+{
+  if(n < 0){
+    sfence_vma();
+    return;
+  }
+  for(int i = 0; i < n; i++)
+    sfence_vma_va(va[i]);
+}
+
+// Handle IPIs sent to this hart. Called from devintr().
+void
+ipiintr(void)
+{
+  struct cpu *c = mycpu();
+  uint why;
+
+  why = __sync_fetch_and_and(&c->ipi, 0);
+
+  if(why & IPI_TLB){
+    tlb_flush(shootdown.va, shootdown.n);
+    __sync_synchronize();
+    c->tlb_pending = 0;
+  }
+}
+
+// Make sure no hart uses stale translations for the n
+// addresses in va[] (or any address, if n < 0) of pagetable.
+// The caller must already have changed the PTEs.
+void
+tlb_shootdown(pagetable_t pagetable, uint64 *va, int n)
+{
+  struct cpu *c;
+  int me, targets = 0;
+
+  if(n > TLBBATCH)
+    n = -1;
+
+  // order the caller's PTE stores before the reads of
+  // cpu->upagetable below; usertrapret() does the converse.
+  __sync_synchronize();
+
+  push_off();
+  me = cpuid();
+  tlb_flush(va, n);
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c - cpus != me && c->upagetable == pagetable)
+      targets++;
+  pop_off();
+
+  // almost always the case while processes are single-threaded.
+  if(targets == 0)
+    return;
+
+  acquire(&shootdown.lock);
+  me = cpuid();
+  shootdown.pagetable = pagetable;
+  shootdown.n = n;
+  for(int i = 0; i < n; i++)
+    shootdown.va[i] = va[i];
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c - cpus != me && c->upagetable == pagetable){
+      c->tlb_pending = 1;
+      ipisend(c - cpus, IPI_TLB);
+    }
+  }
+
+  // a target that has since trapped into the kernel flushed
+  // its TLB in uservec and cleared upagetable, so don't wait for
+  // it; it may be spinning on a lock we hold with interrupts off.
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    while(c->tlb_pending && c->upagetable == pagetable)
+      ;
+    c->tlb_pending = 0;
+  }
+
+  release(&shootdown.lock);
+}
+
+void
+tlb_gather_init(struct tlbgather *tg, pagetable_t pagetable)
+{
+  tg->pagetable = pagetable;
+  tg->n = 0;
+  tg->nfree = 0;
+}
+
+// Note that the PTE for va in tg->pagetable has changed.
+void
+tlb_gather_add(struct tlbgather *tg, uint64 va)
+{
+  if(tg->n < 0)
+    return;
+  if(tg->n == TLBBATCH){
+    tg->n = -1;
+    return;
+  }
+  tg->va[tg->n++] = va;
+}
+
+// Free the physical page pa once no TLB can refer to it.
+void
+tlb_gather_free(struct tlbgather *tg, void *pa)
+{
+  if(tg->nfree == TLBBATCH)
+    tlb_gather_flush(tg);
+  tg->free[tg->nfree++] = pa;
+}
+
+// Shoot down everything gathered so far,
+// then free the gathered pages.
+void
+tlb_gather_flush(struct tlbgather *tg)
+{
+  if(tg->n != 0)
+    tlb_shootdown(tg->pagetable, tg->va, tg->n);
+  tg->n = 0;
+  for(int i = 0; i < tg->nfree; i++)
+    kfree(tg->free[i]);
+  tg->nfree = 0;
+}
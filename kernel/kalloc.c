@@ -62,11 +62,28 @@ kfree(void *pa)
   release(&kmem.lock);
 }
 
+// Pages of buffer cache to give back at a time when
+// memory runs out.
+#define NSHRINK 8
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
+{
+  void *pa;
+
+  while((pa = kalloc_noreclaim()) == 0)
+    if(bshrink(NSHRINK) == 0)
+      break;
+  return pa;
+}
+
+// Like kalloc(), but don't shrink the buffer cache to find a
+// page; for the buffer cache itself.
+void *
+kalloc_noreclaim(void)
 {
   struct run *r;
 
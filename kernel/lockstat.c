@@ -0,0 +1,103 @@
+// Lock contention profiling.
+//
+// initlock() and initsleeplock() give each lock a pointer to the
+// statistics for its name, so that all the "proc" locks, say, are
+// counted together. acquire() and acquiresleep() count every
+// acquisition, and those that had to wait and for how long, and
+// release() and releasesleep() record the longest hold. The
+// counters are updated with atomic instructions rather than
+// under a lock, since they are updated from inside acquire().
+//
+// Off by default, since the shared counters are a hot spot of
+// their own; build with make LOCKSTAT=1 to profile.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "lockstat.h"
+#include "defs.h"
+
+static struct lockstat stats[NLOCKSTAT];
+static int nstats;
+static uint busy;   // guards adding to stats[]
+
+// The statistics for locks called name, or 0 if stats[] is full.
+struct lockstat*
+lockstat_find(char *name)
+{
+  struct lockstat *s;
+
+  // initlock() may run before anything else is set up, and
+  // can't use a spinlock itself.
+  while(__sync_lock_test_and_set(&busy, 1) != 0)
+    ;
+  for(s = stats; s < &stats[nstats]; s++)
+    if(strncmp(s->name, name, sizeof(s->name) - 1) == 0)
+      break;
+  if(s == &stats[nstats]){
+    if(nstats == NLOCKSTAT)
+      s = 0;
+    else
+      safestrcpy(stats[nstats++].name, name, sizeof(s->name));
+  }
+  __sync_lock_release(&busy);
+  return s;
+}
+
+// Count an acquisition that waited for wait cycles, if contended.
+void
+lockstat_acquired(struct lockstat *s, int contended, uint64 wait)
+{
+  if(s == 0)
+    return;
+  __atomic_fetch_add(&s->nacquire, 1, __ATOMIC_RELAXED);
+  if(contended){
+    __atomic_fetch_add(&s->ncontended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->wait, wait, __ATOMIC_RELAXED);
+  }
+}
+
+// Note a release after holding the lock for held cycles.
+void
+lockstat_released(struct lockstat *s, uint64 held)
+{
+  uint64 max;
+
+  if(s == 0)
+    return;
+  max = __atomic_load_n(&s->maxhold, __ATOMIC_RELAXED);
+  while(held > max &&
+        !__atomic_compare_exchange_n(&s->maxhold, &max, held, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Copy the statistics of up to n lock names to the user
+// array addr, and return how many were copied. With addr 0,
+// zero all the counters instead.
+int
+getlockstat(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct lockstat s;
+  int i;
+
+  if(addr == 0){
+    for(i = 0; i < nstats; i++){
+      __atomic_store_n(&stats[i].nacquire, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats[i].ncontended, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats[i].wait, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats[i].maxhold, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+  }
+
+  for(i = 0; i < n && i < nstats; i++){
+    s = stats[i];
+    if(copyout(p->pagetable, addr + i*sizeof(s), (char *)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return i;
+}
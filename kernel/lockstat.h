@@ -0,0 +1,9 @@
+// Contention statistics for all the locks with one name,
+// as returned by getlockstat(). Times are in timer cycles.
+struct lockstat {
+  char name[16];
+  uint64 nacquire;     // acquisitions
+  uint64 ncontended;   // acquisitions that had to wait
+  uint64 wait;         // total time spent waiting
+  uint64 maxhold;      // longest time held
+};
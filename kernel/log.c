@@ -19,7 +19,19 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log has been committed.
+//
+// Commits are made by a kernel thread, the committer, not by
+// end_op(), which returns at once. The committer groups all the
+// FS system calls of the last COMMITTICKS ticks into one
+// transaction, or fewer if the log is filling up. Once a commit
+// is due, begin_op() holds off new system calls until the ones
+// in progress finish and the commit is done.
+//
+// So an FS system call is not durable when it returns. Each
+// transaction has an id; an inode notes the id of the last one
+// to change it, and fsync() calls log_force() to wait until
+// that one is committed.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +40,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A commit starts all its log writes before waiting for any,
+// so the disk driver can merge them.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,6 +56,9 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int due;         // commit as soon as outstanding is 0.
+  uint tid;        // id of the transaction being added to.
+  uint committed;  // id of the last committed transaction.
   int dev;
   struct logheader lh;
 };
@@ -50,6 +66,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void committer(void*);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,7 +78,10 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.tid = 1;
   recover_from_log();
+  if(kthread_create(committer, 0, "committer") < 0)
+    panic("initlog: committer");
 }
 
 // Copy committed blocks from log to their home location
@@ -69,16 +89,21 @@ static void
 install_trans(int recovering)
 {
   int tail;
+  static struct buf *dbuf[LOGSIZE];  // only the committer commits
 
+  // start all the writes, then wait for them.
   for (tail = 0; tail < log.lh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    bwrite_async(dbuf[tail]);  // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
+    if(recovering == 0)
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -128,10 +153,13 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.due){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      log.due = 1;
+      if(log.outstanding == 0)
+        wakeup(&log.due);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -142,19 +170,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// lets the committer know if this was the last outstanding
+// operation and a commit is due.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.due){
+    wakeup(&log.due);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,31 +188,94 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
+// The committer thread. Waits until a commit is due, because
+// the log is filling up or COMMITTICKS have passed since the
+// last one, and no FS system calls are in progress. While the
+// log is empty it sleeps without a timer, so that an idle
+// system doesn't wake up every COMMITTICKS for it; log_write()
+// wakes it with the first block of a transaction.
+static void
+committer(void *arg)
+{
+  uint tid;
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.outstanding > 0 || !log.due){
+      if(log.lh.n == 0)
+        sleep(&log.due, &log.lock);
+      else if(sleep_timeout(&log.due, &log.lock, COMMITTICKS) < 0 && log.lh.n > 0)
+        log.due = 1;
+    }
+    if(log.lh.n == 0){
+      // nothing was written, so it's all committed already.
+      log.due = 0;
+      log.committed = log.tid++;
+      wakeup(&log);
+      continue;
+    }
+    log.committing = 1;
+    log.due = 0;
+    tid = log.tid++;
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
+    release(&log.lock);
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.committed = tid;
     wakeup(&log);
-    release(&log.lock);
   }
 }
 
+// The id of the transaction that FS system calls in progress
+// are part of, or that the next one will be.
+uint
+log_tid(void)
+{
+  uint tid;
+
+  acquire(&log.lock);
+  tid = log.tid;
+  release(&log.lock);
+  return tid;
+}
+
+// Commit now, if transaction tid isn't committed yet, and wait
+// for it. Caller must not be inside an FS system call.
+void
+log_force(uint tid)
+{
+  acquire(&log.lock);
+  while(log.committed < tid){
+    log.due = 1;
+    if(log.outstanding == 0)
+      wakeup(&log.due);
+    sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
 {
   int tail;
+  static struct buf *to[LOGSIZE];
 
+  // start all the writes, then wait for them.
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    to[tail] = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
+    bwrite_async(to[tail]);  // write the log
     brelse(from);
-    brelse(to);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
@@ -230,6 +319,8 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
     log.lh.n++;
+    if(log.lh.n == 1)
+      wakeup(&log.due);  // start the committer's clock
   }
   release(&log.lock);
 }
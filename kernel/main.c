@@ -21,12 +21,16 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    ipiinit();       // inter-processor interrupts
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pcacheinit();    // mmap() page cache
+    futexinit();     // futex locks
+    cow_init();      // copy-on-write groups
     virtio_disk_init(); // emulated hard disk
 
     /* CSE 536: Initialize all PSA regions when OS boots. */
@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending.
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +63,16 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap regions
+//   TRAPFRAMEN(NTHREAD-1) ... TRAPFRAMEN(1) (other threads' trapframes)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// threads sharing a page table each have their own trapframe,
+// one page below the other; slot 0 is the group leader's.
+#define TRAPFRAMEN(slot) (TRAPFRAME - (slot)*PGSIZE)
+
+// mmap() regions are allocated downwards from here,
+// leaving an unmapped guard page below the trapframes.
+#define MMAPTOP (TRAPFRAMEN(NTHREAD-1) - PGSIZE)
@@ -0,0 +1,438 @@
+// Memory-mapped regions.
+//
+// Each process has a list of up to NVMA regions created by
+// mmap(), kept sorted by address in p->vma[0..nvma-1]. Regions
+// are placed top-down below MMAPTOP, far above the heap.
+//
+// Pages of a region are not allocated by mmap(). Each page of an
+// anonymous or MAP_PRIVATE file region gets a heap_tracker entry,
+// so the page fault handler in pfault.c fills it on first touch
+// (with zeroes, or a copy of the file's page), and it takes part
+// in swapping to the PSA exactly like an on-demand heap page.
+//
+// Pages of a MAP_SHARED file region are pages of the file's page
+// cache (pcache.c), mapped by mmap_fault(). They start out without
+// PTE_W, so that the first store faults and marks the page dirty
+// (PTE_D); munmap() and msync() write dirty pages back to the file.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+// Is v a MAP_SHARED mapping of a file?
+static int
+vma_shared(struct vma *v)
+{
+  return v->file && (v->flags & MAP_SHARED);
+}
+
+// Find the region containing va, or 0.
+// Tries the region found last time first.
+struct vma*
+vma_lookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  int lo, hi, mid;
+
+  if(p->vmahint < p->nvma){
+    v = &p->vma[p->vmahint];
+    if(va >= v->start && va < v->end)
+      return v;
+  }
+
+  lo = 0;
+  hi = p->nvma - 1;
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    v = &p->vma[mid];
+    if(va < v->start)
+      hi = mid - 1;
+    else if(va >= v->end)
+      lo = mid + 1;
+    else {
+      p->vmahint = mid;
+      return v;
+    }
+  }
+  return 0;
+}
+
+// PTE permission bits for pages of v, beyond PTE_R|PTE_U.
+int
+vma_perm(struct vma *v)
+{
+  int perm = 0;
+
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Check a fault with the given scause against v's protection.
+// Returns 0 if the access is allowed, -1 if not.
+int
+vma_access(struct vma *v, uint64 scause)
+{
+  if(scause == 12 && (v->prot & PROT_EXEC) == 0)
+    return -1;
+  if(scause == 13 && (v->prot & PROT_READ) == 0)
+    return -1;
+  if(scause == 15 && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  return 0;
+}
+
+// Insert a copy of *nv into p's sorted region list.
+static int
+vma_insert(struct proc *p, struct vma *nv)
+{
+  int i;
+
+  if(p->nvma >= NVMA)
+    return -1;
+  for(i = p->nvma; i > 0 && p->vma[i-1].start > nv->start; i--)
+    p->vma[i] = p->vma[i-1];
+  p->vma[i] = *nv;
+  p->nvma++;
+  p->vmahint = i;
+  return i;
+}
+
+static void
+vma_remove(struct proc *p, int i)
+{
+  if(p->vma[i].file)
+    fileclose(p->vma[i].file);
+  for(; i + 1 < p->nvma; i++)
+    p->vma[i] = p->vma[i+1];
+  p->nvma--;
+  p->vmahint = 0;
+}
+
+// Find len bytes of unused address space, as high as possible
+// below MMAPTOP and above the heap. Returns 0 if there is none.
+static uint64
+vma_place(struct proc *p, uint64 len)
+{
+  uint64 top = MMAPTOP;
+
+  for(int i = p->nvma - 1; i >= 0; i--){
+    if(top - p->vma[i].end >= len)
+      break;
+    top = p->vma[i].start;
+  }
+  if(top < len || top - len < PGROUNDUP(p->sz))
+    return 0;
+  return top - len;
+}
+
+// Discard the pages of [start, end) of region v in p's address
+// space: release their heap tracker entries and swap slots, then
+// unmap and free the resident ones. Shared file pages are written
+// back if dirty, and given back to the page cache; they are
+// unmapped TLBBATCH at a time, so that each batch costs one TLB
+// shootdown, and only then written back, so no store is missed.
+static void
+vma_unmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va, a, pa[TLBBATCH];
+  pte_t *pte;
+  int i, n, dirty[TLBBATCH];
+
+  if(vma_shared(v)){
+    for(va = start; va < end; va += n*PGSIZE){
+      n = (end - va) / PGSIZE;
+      if(n > TLBBATCH)
+        n = TLBBATCH;
+      for(i = 0; i < n; i++){
+        a = va + i*PGSIZE;
+        pa[i] = 0;
+        if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+          continue;
+        pa[i] = PTE2PA(*pte);
+        dirty[i] = (*pte & PTE_D) && (v->prot & PROT_WRITE);
+      }
+      uvmunmap(p->pagetable, va, n, 0);
+      for(i = 0; i < n; i++){
+        if(pa[i] == 0)
+          continue;
+        a = va + i*PGSIZE;
+        if(dirty[i])
+          pcache_writeback(v->file->ip, (v->off + a - v->start) / PGSIZE, (char*)pa[i]);
+        pcache_put(v->file->ip, (char*)pa[i]);
+      }
+    }
+    return;
+  }
+
+  for(va = start; va < end; va += PGSIZE){
+    if((i = heap_find(p, va)) >= 0)
+      heap_untrack(p, i);
+  }
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Create a new region of len bytes: anonymous memory if f is 0,
+// otherwise the part of file f starting at offset off.
+// Returns its address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc()->leader;
+  struct vma nv;
+  uint64 va;
+
+  if(len == 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) != MAP_SHARED &&
+     (flags & (MAP_SHARED|MAP_PRIVATE)) != MAP_PRIVATE)
+    return -1;
+  if(f == 0){
+    // there are no page reference counts, so anonymous
+    // pages can't be shared with fork()ed children.
+    if((flags & MAP_ANONYMOUS) == 0 || (flags & MAP_SHARED))
+      return -1;
+    off = 0;
+  } else {
+    if(f->type != FD_INODE || !f->readable || (off % PGSIZE) != 0)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  if((nv.start = vma_place(p, len)) == 0)
+    return -1;
+  nv.end = nv.start + len;
+  nv.prot = prot;
+  nv.flags = flags;
+  nv.file = f;
+  nv.off = off;
+
+  if(!vma_shared(&nv)){
+    for(va = nv.start; va < nv.end; va += PGSIZE){
+      if(heap_track(p, va) < 0){
+        vma_unmap(p, &nv, nv.start, va);
+        return -1;
+      }
+    }
+  }
+  if(vma_insert(p, &nv) < 0){
+    vma_unmap(p, &nv, nv.start, nv.end);
+    return -1;
+  }
+  if(f)
+    filedup(f);
+  return nv.start;
+}
+
+// Map the page at va of the shared file region v, or note
+// that it has been written to. Returns 0, or -1 if the page
+// cache is out of pages.
+int
+mmap_fault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  pte_t *pte;
+  char *pa;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // first store to a clean page.
+    if(write)
+      *pte |= PTE_W | PTE_D;
+    return 0;
+  }
+
+  if((pa = pcache_get(v->file->ip, (v->off + va - v->start) / PGSIZE)) == 0)
+    return -1;
+  perm = PTE_R | PTE_U | (vma_perm(v) & ~PTE_W);
+  if(write)
+    perm |= PTE_W | PTE_D;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    pcache_put(v->file->ip, pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Copy the file's content for the page at va of the
+// MAP_PRIVATE file region v into mem, a page that isn't
+// mapped yet.
+int
+mmap_fill(struct vma *v, uint64 va, char *mem)
+{
+  char *pa;
+
+  if((pa = pcache_get(v->file->ip, (v->off + va - v->start) / PGSIZE)) == 0)
+    return -1;
+  memmove(mem, pa, PGSIZE);
+  pcache_put(v->file->ip, pa);
+  return 0;
+}
+
+// Remove the mappings for [addr, addr+len), which may cover
+// any part of any number of regions.
+// Returns 0 on success, -1 on error.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc()->leader;
+  struct vma *v, tail;
+  uint64 start, end;
+  int i;
+
+  if((addr % PGSIZE) != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(i = 0; i < p->nvma; i++){
+    v = &p->vma[i];
+    if(v->end <= addr || v->start >= end)
+      continue;
+    start = v->start > addr ? v->start : addr;
+    uint64 stop = v->end < end ? v->end : end;
+
+    if(start > v->start && stop < v->end){
+      // punch a hole: split v in two.
+      if(p->nvma >= NVMA)
+        return -1;
+      tail = *v;
+      tail.off += stop - v->start;
+      tail.start = stop;
+      vma_unmap(p, v, start, stop);
+      v->end = start;
+      if(tail.file)
+        filedup(tail.file);
+      vma_insert(p, &tail);
+      break;
+    }
+
+    vma_unmap(p, v, start, stop);
+    if(start == v->start && stop == v->end){
+      vma_remove(p, i);
+      i--;
+    } else if(start == v->start){
+      v->off += stop - v->start;
+      v->start = stop;
+    } else {
+      v->end = start;
+    }
+  }
+  return 0;
+}
+
+// Write the dirty shared file pages in [addr, addr+len) back
+// to their files. Returns 0 on success, -1 on error.
+int
+msync(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc()->leader;
+  struct vma *v;
+  uint64 va, end;
+  pte_t *pte;
+  int i, r = 0;
+
+  if((addr % PGSIZE) != 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(i = 0; i < p->nvma; i++){
+    v = &p->vma[i];
+    if(!vma_shared(v) || (v->prot & PROT_WRITE) == 0)
+      continue;
+    for(va = v->start > addr ? v->start : addr; va < v->end && va < end; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0 ||
+         (*pte & PTE_D) == 0)
+        continue;
+      // clean it before writing, so that stores made while
+      // the write is in progress fault and dirty it again.
+      *pte &= ~(PTE_W | PTE_D);
+      tlb_shootdown(p->pagetable, &va, 1);
+      if(pcache_writeback(v->file->ip, (v->off + va - v->start) / PGSIZE,
+                          (char*)PTE2PA(*pte)) < 0)
+        r = -1;
+    }
+  }
+  return r;
+}
+
+// Give fork()'s child np the same regions as p. Resident pages
+// are copied, or shared copy-on-write if cow is set; heap_copy()
+// has already copied the tracker entries for the others. Shared
+// file pages are mapped clean in np, so np's stores mark them dirty.
+int
+vma_copy(struct proc *p, struct proc *np, int cow)
+{
+  struct tlbgather tg;
+  pte_t *pte;
+  uint64 va, pa;
+  uint flags;
+  char *mem;
+
+  tlb_gather_init(&tg, p->pagetable);
+  for(int i = 0; i < p->nvma; i++){
+    struct vma *v = &p->vma[i];
+    np->vma[i] = *v;
+    np->nvma = i + 1;
+    if(v->file)
+      filedup(v->file);
+    for(va = v->start; va < v->end; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      if(vma_shared(v)){
+        flags &= ~(PTE_W | PTE_D);
+        if(mappages(np->pagetable, va, PGSIZE, pa, flags) != 0)
+          goto err;
+        pcache_dup(v->file->ip, (char*)pa);
+      } else if(cow){
+        flags &= ~PTE_W;
+        if(mappages(np->pagetable, va, PGSIZE, pa, flags) != 0)
+          goto err;
+        add_shmem(p->cow_group, pa);
+        *pte = PA2PTE(pa) | flags;
+        tlb_gather_add(&tg, va);
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+        if(mappages(np->pagetable, va, PGSIZE, (uint64)mem, flags) != 0){
+          kfree(mem);
+          goto err;
+        }
+      }
+    }
+  }
+  tlb_gather_flush(&tg);
+  return 0;
+
+ err:
+  tlb_gather_flush(&tg);
+  return -1;
+}
+
+// Unmap all of p's regions, when its address space goes away.
+// May write back file pages, so must not be called with locks held.
+void
+vma_free(struct proc *p)
+{
+  for(int i = 0; i < p->nvma; i++){
+    vma_unmap(p, &p->vma[i], p->vma[i].start, p->vma[i].end);
+    if(p->vma[i].file)
+      fileclose(p->vma[i].file);
+  }
+  p->nvma = 0;
+  p->vmahint = 0;
+}
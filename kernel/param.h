@@ -1,23 +1,52 @@
 #define NPROC        64  // maximum number of processes
+#define NPIDHASH     31  // pid hash table buckets
 #define NCPU          8  // maximum number of CPUs
+#define NWAITQ       61  // sleep/wakeup hash buckets
+#define NMLFQ         3  // scheduler priority levels
+#define MLFQAGE     100  // ticks between boosts of waiting processes
+#define NICEMAX      19  // largest (least favoured) nice value
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mmap regions per process
+#define NTHREAD       8  // threads sharing one address space
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
+#define NCPAGE      128  // pages in the mmap() page cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*10) // max data blocks in on-disk log; make LOGSIZE=n (< 255) to change
+#endif
+#define COMMITTICKS  2     // ticks a finished FS op may wait to be committed
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS)  // initial and minimum size of disk block cache
+#define BCACHEFRAC   16    // disk block cache grows to at most 1/BCACHEFRAC of RAM
+#define RAMAX        32    // largest readahead window, in blocks
+#define NBUFHASH     13    // buffer cache hash buckets
 // #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define FSSIZE       6000  // size of file system in blocks
+#define TLBBATCH     16    // max addresses flushed individually per shootdown
+#ifndef LOCKSTAT
+#define LOCKSTAT     0     // count lock acquisitions, waits and hold times; make LOCKSTAT=1 to change
+#endif
+#define NLOCKSTAT    64    // distinct lock names counted
+#define FSSIZE       (5970+LOGSIZE)  // size of file system in blocks
+#ifndef HZ
+#define HZ           10    // timer ticks per second; make HZ=n to change
+#endif
+#define TIMERFREQ    10000000  // CLINT mtime increments per second (qemu)
+#define TICKINTERVAL (TIMERFREQ / HZ)  // mtime increments per tick
+#ifndef DISKPOLL
+#define DISKPOLL     0     // usecs a disk wait polls before sleeping; make POLL=n to change
+#endif
+#define TICKLESS     1     // idle harts stop ticking until the next timer deadline
 
 /* CSE 536: changed to 3000 to use the last 1000 blocks for page swapping. */
-#define PSASTART                33       // Starting page save area (PSA) block
-#define PSAEND                  4032     // Ending page save area (PSA) block
+#define PSASTART                (2+LOGSIZE)  // Starting page save area (PSA) block, after the log
+#define PSAEND                  (PSASTART+PSASIZE)  // Ending page save area (PSA) block
 #define PSASIZE                 4000     // total size of the PSA
 
 /* CSE 536: heap-related definitions. */
 #define MAXHEAP                 1000     // maximum pages for heap allocation
 #define MAXRESHEAP              100      // maximum in-memory pages for heap allocation
+#define HEAPRA                  4        // heap pages read ahead for MADV_SEQUENTIAL
@@ -0,0 +1,242 @@
+// Page cache for file-backed mmap().
+//
+// Each in-memory inode has a list (ip->pages) of page-sized
+// chunks of its content, read straight from the file's blocks
+// with bmap() and bread(). Every process that maps the same page
+// of a file with MAP_SHARED maps the same physical page, so
+// loads and stores go straight to the cache without a copy.
+// MAP_PRIVATE pages start out as copies of cached pages.
+//
+// A cached page is written back to the file by munmap() and
+// msync() when the mapping's PTE is dirty. Pages that are no
+// longer mapped stay cached until the inode leaves the inode
+// table, or their slot is needed for another page.
+//
+// Locking: pcache.lock protects the lists and reference counts.
+// Pages are only filled, and only looked up, with the inode's
+// sleep-lock held, so no one can see a page before it is filled.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "buf.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NCPAGE];
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Find a free page cache entry, or recycle one that
+// isn't mapped anywhere. Caller holds pcache.lock.
+static struct cpage*
+pcache_alloc(void)
+{
+  struct cpage *cp, **pp;
+
+  for(cp = pcache.page; cp < &pcache.page[NCPAGE]; cp++)
+    if(cp->ip == 0)
+      return cp;
+
+  for(cp = pcache.page; cp < &pcache.page[NCPAGE]; cp++){
+    if(cp->ref == 0){
+      for(pp = &cp->ip->pages; *pp != cp; pp = &(*pp)->next)
+        ;
+      *pp = cp->next;
+      cp->ip = 0;
+      return cp;
+    }
+  }
+  return 0;
+}
+
+// Read page pgoff of ip into pa. Caller holds ip->lock.
+static void
+pcache_fill(struct inode *ip, uint pgoff, char *pa)
+{
+  struct buf *bp;
+  uint off, m;
+
+  memset(pa, 0, PGSIZE);
+  for(off = pgoff*PGSIZE; off < (pgoff+1)*PGSIZE && off < ip->size; off += BSIZE){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(BSIZE, ip->size - off);
+    memmove(pa + (off % PGSIZE), bp->data, m);
+    brelse(bp);
+  }
+}
+
+// Return the cached copy of page pgoff of ip, reading it in
+// if necessary, with one more reference. Returns 0 if the
+// page cache is full of mapped pages.
+// Takes ip->lock unless the caller already holds it. Callers
+// hold mm_lock(), which comes first: see struct proc.
+char*
+pcache_get(struct inode *ip, uint pgoff)
+{
+  struct cpage *cp;
+  char *pa;
+  int locked;
+
+  if((locked = !holdingsleep(&ip->lock)) != 0)
+    ilock(ip);
+  acquire(&pcache.lock);
+  for(cp = ip->pages; cp; cp = cp->next){
+    if(cp->pgoff == pgoff){
+      cp->ref++;
+      release(&pcache.lock);
+      if(locked)
+        iunlock(ip);
+      return cp->pa;
+    }
+  }
+
+  if((cp = pcache_alloc()) == 0){
+    release(&pcache.lock);
+    if(locked)
+      iunlock(ip);
+    return 0;
+  }
+  if(cp->pa == 0 && (cp->pa = kalloc()) == 0){
+    release(&pcache.lock);
+    if(locked)
+      iunlock(ip);
+    return 0;
+  }
+  cp->ip = ip;
+  cp->pgoff = pgoff;
+  cp->ref = 1;
+  cp->next = ip->pages;
+  ip->pages = cp;
+  pa = cp->pa;
+  release(&pcache.lock);
+
+  pcache_fill(ip, pgoff, pa);
+  if(locked)
+    iunlock(ip);
+  return pa;
+}
+
+static struct cpage*
+pcache_find(struct inode *ip, char *pa)
+{
+  struct cpage *cp;
+
+  for(cp = ip->pages; cp; cp = cp->next)
+    if(cp->pa == pa)
+      return cp;
+  panic("pcache_find");
+}
+
+// Another mapping of the cached page pa, e.g. in a fork()ed child.
+void
+pcache_dup(struct inode *ip, char *pa)
+{
+  acquire(&pcache.lock);
+  pcache_find(ip, pa)->ref++;
+  release(&pcache.lock);
+}
+
+// A mapping of the cached page pa has gone away.
+void
+pcache_put(struct inode *ip, char *pa)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  cp = pcache_find(ip, pa);
+  if(cp->ref < 1)
+    panic("pcache_put");
+  cp->ref--;
+  release(&pcache.lock);
+}
+
+// Write the cached page pgoff of ip back to the file. Only
+// the part of the page inside the file is written, so the
+// file doesn't grow and no blocks need to be allocated, and
+// one page always fits in a single log transaction.
+// Returns 0 on success, -1 on error.
+int
+pcache_writeback(struct inode *ip, uint pgoff, char *pa)
+{
+  struct buf *bp;
+  uint off, addr;
+  int r = 0;
+
+  begin_op();
+  ilock(ip);
+  for(off = pgoff*PGSIZE; off < (pgoff+1)*PGSIZE && off < ip->size; off += BSIZE){
+    if((addr = bmap(ip, off/BSIZE)) == 0){
+      r = -1;
+      break;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, pa + (off % PGSIZE), min(BSIZE, ip->size - off));
+    log_write(bp);
+    brelse(bp);
+  }
+  ip->tid = log_tid();
+  iunlock(ip);
+  end_op();
+  return r;
+}
+
+// writei() has put n bytes at off in ip; keep any cached
+// copy of that part of the file up to date.
+// Caller holds ip->lock.
+void
+pcache_update(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  for(cp = ip->pages; cp; cp = cp->next){
+    if(cp->pgoff == off / PGSIZE)
+      memmove(cp->pa + (off % PGSIZE), src, n);
+  }
+  release(&pcache.lock);
+}
+
+// ip's content was discarded; so is the cached copy.
+// Caller holds ip->lock.
+void
+pcache_trunc(struct inode *ip)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  for(cp = ip->pages; cp; cp = cp->next)
+    memset(cp->pa, 0, PGSIZE);
+  release(&pcache.lock);
+}
+
+// ip is leaving the inode table, and nothing maps
+// its pages any more. Free them.
+void
+pcache_drop(struct inode *ip)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  while((cp = ip->pages) != 0){
+    if(cp->ref != 0)
+      panic("pcache_drop");
+    ip->pages = cp->next;
+    kfree(cp->pa);
+    cp->pa = 0;
+    cp->ip = 0;
+  }
+  release(&pcache.lock);
+}
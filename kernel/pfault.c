@@ -7,6 +7,7 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fcntl.h"
 
 #include "sleeplock.h"
 #include "fs.h"
@@ -17,42 +18,180 @@ int flags2perm(int flags);
 
 /* CSE 536: (2.4) read current time. */
 uint64 read_current_timestamp() {
-  uint64 curticks = 0;
-  acquire(&tickslock);
-  curticks = ticks;
-  wakeup(&ticks);
-  release(&tickslock);
-  return curticks;
+  return readticks();
 }
 
+struct spinlock psa_lock;
 bool psa_tracker[PSASIZE];
 
 /* All blocks are free during initialization. */
 void init_psa_regions(void)
 {
+    initlock(&psa_lock, "psa");
     for (int i = 0; i < PSASIZE; i++) 
         psa_tracker[i] = false;
 }
 
-/* Evict heap page to disk when resident pages exceed limit */
-void evict_page_to_disk(struct proc* p) {
-    /* Find free block */
-    int blockno = 0;
-    for (int i = 0; i <= PSASIZE; ++i){
-      if(psa_tracker[i] == false) {
-        blockno = i;
-        break;
+/* Allocate the 4 PSA blocks for one page. Returns the first block, or -1. */
+int psa_alloc(void)
+{
+    acquire(&psa_lock);
+    for (int i = 0; i + 4 <= PSASIZE; i += 4) {
+      if (psa_tracker[i] == false) {
+        for (int j = i; j < i + 4; j++)
+          psa_tracker[j] = true;
+        release(&psa_lock);
+        return i;
+      }
+    }
+    release(&psa_lock);
+    return -1;
+}
+
+/* Release the PSA blocks of a page that is no longer swapped out. */
+void psa_free(int blockno)
+{
+    acquire(&psa_lock);
+    for (int i = blockno; i < blockno + 4; i++)
+      psa_tracker[i] = false;
+    release(&psa_lock);
+}
+
+/* Copy a swapped-out page to a new PSA slot, for fork(). Returns the new slot. */
+int psa_dup(int blockno)
+{
+    int newblock = psa_alloc();
+    if (newblock < 0)
+      return -1;
+    struct buf *to[4];
+    for (int i = 0; i < 4; i++)
+      breadahead(1, PSASTART + blockno + i);
+    for (int i = 0; i < 4; i++) {
+      struct buf *from = bread(1, PSASTART + blockno + i);
+      to[i] = bread(1, PSASTART + newblock + i);
+      memmove(to[i]->data, from->data, BSIZE);
+      bwrite_async(to[i]);
+      brelse(from);
+    }
+    for (int i = 0; i < 4; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
+    return newblock;
+}
+
+/* Find the heap tracker entry for the page at va, or -1. */
+int heap_find(struct proc *p, uint64 va)
+{
+    for (int i = 0; i < MAXHEAP; i++) {
+      if (va != 0 && p->heap_tracker[i].addr == va)
+        return i;
+    }
+    return -1;
+}
+
+/* Start tracking a not-yet-loaded page at va. Returns its entry, or -1 if full. */
+int heap_track(struct proc *p, uint64 va)
+{
+    for (int i = 0; i < MAXHEAP; i++) {
+      if (p->heap_tracker[i].addr == 0 || p->heap_tracker[i].addr == 0xFFFFFFFFFFFFFFFF) {
+        p->heap_tracker[i].addr           = va;
+        p->heap_tracker[i].loaded         = false;
+        p->heap_tracker[i].startblock     = -1;
+        p->heap_tracker[i].last_load_time = 0xFFFFFFFFFFFFFFFF;
+        p->heap_tracker[i].advice         = MADV_NORMAL;
+        return i;
       }
     }
+    return -1;
+}
+
+/* Stop tracking entry i: release its swap slot, or account for its
+ * resident frame. The caller unmaps (and frees) the page itself. */
+void heap_untrack(struct proc *p, int i)
+{
+    pte_t *pte;
+
+    if (p->heap_tracker[i].startblock >= 0) {
+      psa_free(p->heap_tracker[i].startblock);
+    } else if ((pte = walk(p->pagetable, p->heap_tracker[i].addr, 0)) != 0 && (*pte & PTE_V)) {
+      p->resident_heap_pages--;
+    }
+    p->heap_tracker[i].addr           = 0xFFFFFFFFFFFFFFFF;
+    p->heap_tracker[i].loaded         = false;
+    p->heap_tracker[i].startblock     = -1;
+    p->heap_tracker[i].last_load_time = 0xFFFFFFFFFFFFFFFF;
+    p->heap_tracker[i].advice         = MADV_NORMAL;
+}
+
+/* Stop tracking the heap pages in [newsz, oldsz), when the heap
+ * shrinks. The caller unmaps (and frees) the resident ones. */
+void heap_shrink(struct proc *p, uint64 oldsz, uint64 newsz)
+{
+    uint64 lo = PGROUNDUP(newsz), hi = PGROUNDUP(oldsz);
+
+    for (int i = 0; i < MAXHEAP; i++) {
+      if (p->heap_tracker[i].addr >= lo && p->heap_tracker[i].addr < hi)
+        heap_untrack(p, i);
+    }
+}
+
+/* Release every swap slot held by p, when its heap is discarded. */
+void heap_release(struct proc *p)
+{
+    for (int i = 0; i < MAXHEAP; i++) {
+      if (p->heap_tracker[i].startblock >= 0)
+        psa_free(p->heap_tracker[i].startblock);
+      p->heap_tracker[i].startblock = -1;
+    }
+}
+
+/* Give fork()'s child np its own copy of p's heap tracker. Pages
+ * that are swapped out get a private copy of their PSA slot. */
+int heap_copy(struct proc *p, struct proc *np)
+{
+    for (int i = 0; i < MAXHEAP; i++) {
+      np->heap_tracker[i] = p->heap_tracker[i];
+      if (p->heap_tracker[i].startblock >= 0) {
+        if ((np->heap_tracker[i].startblock = psa_dup(p->heap_tracker[i].startblock)) < 0)
+          return -1;
+      }
+    }
+    np->resident_heap_pages = p->resident_heap_pages;
+    return 0;
+}
+
+/* Is the page of heap_tracker[i] in memory? */
+static bool heap_resident(struct proc *p, int i)
+{
+    pte_t *pte = walk(p->pagetable, p->heap_tracker[i].addr, 0);
+    return pte != 0 && (*pte & PTE_V);
+}
+
+/* Evict heap page to disk when resident pages exceed limit. Pages
+ * advised MADV_SEQUENTIAL that lie behind cursor, the page about to
+ * be loaded, have been passed already and go first.
+ * Returns 0, or -1 if the page couldn't be saved. */
+int evict_page_to_disk(struct proc* p, uint64 cursor) {
+    /* Find free block */
+    int blockno = psa_alloc();
+    if (blockno < 0)
+      panic("evict_page_to_disk: PSA full");
 
     /* Find victim page using FIFO. */
     uint64 victim_time = p->heap_tracker[0].last_load_time;
     int page_index = 0;
+    bool behind = false;
     for (int i = 0; i < MAXHEAP; i++)
     { 
-      if(p->heap_tracker[i].last_load_time < victim_time){
+      if (p->heap_tracker[i].last_load_time == 0xFFFFFFFFFFFFFFFF)
+        continue;
+      bool b = p->heap_tracker[i].advice == MADV_SEQUENTIAL &&
+               p->heap_tracker[i].addr < cursor;
+      if((b && !behind) || (b == behind && p->heap_tracker[i].last_load_time < victim_time)){
         victim_time = p->heap_tracker[i].last_load_time;
         page_index = i;
+        behind = b;
       }
     }
     
@@ -60,36 +199,46 @@ void evict_page_to_disk(struct proc* p) {
     print_evict_page(p->heap_tracker[page_index].addr, blockno);
     /* Read memory from the user to kernel memory first. */
     char *kpage;
-    kpage = kalloc();
+    if ((kpage = kalloc()) == 0) {
+      psa_free(blockno);
+      return -1;
+    }
     int result = copyin(p->pagetable, kpage, p->heap_tracker[page_index].addr, PGSIZE);
     if (result == -1) {
-      return;
+      kfree(kpage);
+      psa_free(blockno);
+      return -1;
     }
     /* Write to the disk blocks. Below is a template as to how this works. There is
      * definitely a better way but this works for now. :p */
-    struct buf* b;
+    struct buf* b[4];
 
     for(int i = blockno; i < blockno+4; ++i) {
     
-    b = bread(1, PSASTART + i);
+    b[i-blockno] = bread(1, PSASTART + i);
 
-    memmove(b->data, ((uint64)kpage) +((i-blockno)*BSIZE), (BSIZE));
-    bwrite(b);
-    brelse(b);
-    psa_tracker[i] = true;
+    memmove(b[i-blockno]->data, kpage + ((i-blockno)*BSIZE), (BSIZE));
+    bwrite_async(b[i-blockno]);
+    }
+    for(int i = 0; i < 4; ++i) {
+    bwait(b[i]);
+    brelse(b[i]);
     }
     
-    /* Unmap swapped out page */
+    /* Unmap swapped out page, and free its frame. */
 
-    uvmunmap(p->pagetable, p->heap_tracker[page_index].addr, 1, 0);
+    uvmunmap(p->pagetable, p->heap_tracker[page_index].addr, 1, 1);
     kfree(kpage);
     /* Update the resident heap tracker. */
     p->resident_heap_pages-=1;
+    p->heap_tracker[page_index].startblock = blockno;
     p->heap_tracker[page_index].last_load_time = 0xFFFFFFFFFFFFFFFF;
+    return 0;
 }
 
-/* Retrieve faulted page from disk. */
-void retrieve_page_from_disk(struct proc* p, uint64 uvaddr) {
+/* Read the swapped-out page at uvaddr from disk into kpage, which
+ * isn't mapped yet. The caller frees its PSA slot once it is. */
+void retrieve_page_from_disk(struct proc* p, uint64 uvaddr, char *kpage) {
     /* Find where the page is located in disk */
     int page_position = -1;
     for (int i = 0; i < MAXHEAP; i++)
@@ -104,65 +253,280 @@ void retrieve_page_from_disk(struct proc* p, uint64 uvaddr) {
     int blockno = p->heap_tracker[page_position].startblock;
     print_retrieve_page(uvaddr, p->heap_tracker[page_position].startblock);
 
-    /* Create a kernel page to read memory temporarily into first. */
-    char *kpage;
-    kpage = kalloc();
-    
-    /* Read the disk block into temp kernel page. */
+    /* Read the disk blocks straight into the page. */
+  for(int i = blockno; i < blockno+4; ++i)
+    breadahead(1, PSASTART+(i));
   for(int i = blockno; i < blockno+4; ++i) {  
     struct buf* b;
     b = bread(1, PSASTART+(i));
-    memmove(((uint64)kpage) +((i-blockno)*(BSIZE)), b->data, (BSIZE));
+    memmove(kpage + ((i-blockno)*(BSIZE)), b->data, (BSIZE));
     brelse(b);
     }
-    copyout(p->pagetable,uvaddr, kpage, PGSIZE);
 }
 
-void page_fault_handler(void) 
+/* Bring the tracked heap (or mmap region v) page in heap_tracker[position]
+ * into memory, evicting another page if needed. */
+int heap_page_in(struct proc *p, int position, struct vma *v)
 {
-    /* Current process struct */
-    struct proc *p = myproc();
+    uint64 va = p->heap_tracker[position].addr;
+    int perm = v ? vma_perm(v) : PTE_W;
+    bool first_load = p->heap_tracker[position].loaded == false;
 
     /* Track whether the heap page should be brought back from disk or not. */
-    bool load_from_disk = false;
-    
+    bool load_from_disk = p->heap_tracker[position].loaded == true &&
+                          p->heap_tracker[position].startblock >= 0;
+
+    /* 2.4: Check if resident pages are more than heap pages. If yes, evict. */
+    bool isHeapFull = false;
+    int heapCount = 0;
+    for (int i = 0; i < MAXHEAP; i++)
+    { 
+      if(p->heap_tracker[i].addr != 0xFFFFFFFFFFFFFFFF){
+        ++heapCount;
+      }
+    }
+    if(heapCount == MAXHEAP) {
+          isHeapFull = true;
+    }
+    /* Without a page to evict there is no room to bring a swapped
+     * page back, and a zero page in its place would lose its data. */
+    if (load_from_disk && isHeapFull)
+        return -1;
+    if (p->resident_heap_pages >= MAXRESHEAP && !isHeapFull) {
+        if (evict_page_to_disk(p, va) < 0)
+            return -1;
+    }
+
+    /* 2.3: Fill a heap page, and only then map it into the process'
+     * address space: its other threads share the page table, and
+     * could use the page the moment it is mapped, without a fault. */
+    char *mem;
+    if ((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+
+    /* 2.4: Heap page was swapped to disk previously. We must load it from disk. */
+    if (load_from_disk)
+        retrieve_page_from_disk(p, va, mem);
+
+    /* A MAP_PRIVATE file page starts out as a copy of the file. */
+    if (first_load && v && v->file && mmap_fill(v, va, mem) < 0) {
+        kfree(mem);
+        return -1;
+    }
+
+    if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_U | perm) != 0) {
+        kfree(mem);
+        return -1;
+    }
+
+    /* The page is resident again; its PSA slot can be reused. */
+    if (load_from_disk) {
+        psa_free(p->heap_tracker[position].startblock);
+        p->heap_tracker[position].startblock = -1;
+    }
+
+    /* 2.4: Update the last load time for the loaded heap page in p->heap_tracker. */
+    p->heap_tracker[position].last_load_time = read_current_timestamp();
+    p->heap_tracker[position].loaded = true;
+
+    /* Track that another heap page has been brought into memory. */
+    p->resident_heap_pages++;
+    return 0;
+}
+
+/* After a fault on heap_tracker[position], bring in the next few
+ * pages too if the application said it reads them in order. */
+static void heap_readahead(struct proc *p, int position)
+{
+    uint64 va = p->heap_tracker[position].addr;
+    int i;
+
+    if (p->heap_tracker[position].advice != MADV_SEQUENTIAL)
+      return;
+    for (int k = 1; k <= HEAPRA; k++) {
+      va += PGSIZE;
+      if ((i = heap_find(p, va)) < 0 || p->heap_tracker[i].advice != MADV_SEQUENTIAL)
+        break;
+      if (heap_resident(p, i))
+        continue;
+      if (heap_page_in(p, i, vma_lookup(p, va)) < 0)
+        break;
+    }
+}
+
+/* Throw away the contents of heap_tracker[i]'s page: free its frame
+ * or swap slot. It will be zero-filled (or read from its file) again
+ * on the next touch. */
+static void heap_discard(struct proc *p, int i)
+{
+    uint64 va = p->heap_tracker[i].addr;
+
+    if (p->heap_tracker[i].startblock >= 0) {
+      psa_free(p->heap_tracker[i].startblock);
+    } else if (heap_resident(p, i)) {
+      uvmunmap(p->pagetable, va, 1, 1);
+      p->resident_heap_pages--;
+    }
+    p->heap_tracker[i].loaded         = false;
+    p->heap_tracker[i].startblock     = -1;
+    p->heap_tracker[i].last_load_time = 0xFFFFFFFFFFFFFFFF;
+}
+
+/* Apply madvise() advice to the tracked pages in [addr, addr+len).
+ * Returns 0, or -1 if the advice is unknown. */
+int madvise(uint64 addr, uint64 len, int advice)
+{
+    struct proc *p = myproc()->leader;
+    uint64 va, end;
+    int i;
+
+    if ((addr % PGSIZE) != 0 || addr + len < addr)
+      return -1;
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED)
+      return -1;
+    end = PGROUNDUP(addr + len);
+
+    for (va = addr; va < end; va += PGSIZE) {
+      if ((i = heap_find(p, va)) < 0)
+        continue;
+      switch (advice) {
+      case MADV_NORMAL:
+      case MADV_RANDOM:
+      case MADV_SEQUENTIAL:
+        p->heap_tracker[i].advice = advice;
+        break;
+      case MADV_WILLNEED:
+        /* Prefetch only into free resident slots; evicting
+         * other pages to make room would defeat the purpose. */
+        if (heap_resident(p, i))
+          break;
+        if (p->resident_heap_pages >= MAXRESHEAP || heap_page_in(p, i, vma_lookup(p, va)) < 0)
+          return 0;
+        break;
+      case MADV_DONTNEED:
+        heap_discard(p, i);
+        break;
+      }
+    }
+    return 0;
+}
+
+/* Bring in the heap or mmap page at va of p's address space
+ * for vmfault(), and make it writable if write is set and the
+ * region allows it. Caller holds mm_lock(). */
+static uint64 vmfault_in(struct proc *p, uint64 va, int write)
+{
+    pagetable_t pagetable = p->pagetable;
+    struct vma *v;
+    pte_t *pte;
+    int position, shared;
+
+    v = vma_lookup(p, va);
+    if (v && write && (v->prot & PROT_WRITE) == 0)
+      return 0;
+    shared = v && v->file && (v->flags & MAP_SHARED);
+
+    if (walkaddr(pagetable, va) == 0) {
+      /* Can't sleep on the disk while holding a spinlock. */
+      if (!intr_get())
+        return 0;
+      if (shared) {
+        if (mmap_fault(p, v, va, 0) < 0)
+          return 0;
+      } else {
+        if ((position = heap_find(p, va)) < 0)
+          return 0;
+        if (heap_page_in(p, position, v) < 0)
+          return 0;
+        heap_readahead(p, position);
+      }
+    }
+
+    pte = walk(pagetable, va, 0);
+    if (write && (*pte & PTE_W) == 0) {
+      if (shared)
+        mmap_fault(p, v, va, 1);
+      else if (p->cow_enabled && is_shmem(p->cow_group, PTE2PA(*pte)))
+        copy_on_write(va);
+      else
+        return 0;
+    }
+    return walkaddr(pagetable, va);
+}
+
+/* Called by copyin()/copyout() when a user address isn't mapped,
+ * or, for copyout() (write set), isn't writable: bring in the heap
+ * or mmap page at va, if there is one, and break copy-on-write or
+ * mark a clean shared page writable. A read-only page stays so.
+ * copyout() marks the page dirty itself.
+ * Returns its physical address, or 0. */
+uint64 vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+    struct proc *p = myproc();
+    uint64 pa;
+    int locked;
+
+    if (p == 0 || pagetable != p->pagetable)
+      return 0;
+
+    /* The copy may be on behalf of the fault handler itself.
+     * Under a spinlock (pipe reads, wait()) only the fix-ups
+     * that don't sleep are possible. */
+    if ((locked = !mm_holding(p)) != 0) {
+      if (intr_get())
+        mm_lock(p);
+      else if (!mm_trylock(p))
+        return 0;
+    }
+    pa = vmfault_in(p->leader, PGROUNDDOWN(va), write);
+    if (locked)
+      mm_unlock(p);
+    return pa;
+}
+
+/* Caller holds mm_lock(). */
+void page_fault_handler(void) 
+{
+    /* Owner of the address space; the faulting thread may be another. */
+    struct proc *p = myproc()->leader;
 
     /* Find faulting address. */
     uint64 stval = r_stval();
     uint64 faulting_addr = PGROUNDDOWN(r_stval());
     print_page_fault(p->name, faulting_addr);
 
+    /* A fault in an mmap region must be allowed by its protection. */
+    struct vma *v = vma_lookup(p, faulting_addr);
+    if (v && vma_access(v, r_scause()) < 0) {
+      setkilled(myproc());
+      return;
+    }
+
+    /* Pages of a shared file mapping come from the page cache. */
+    if (v && v->file && (v->flags & MAP_SHARED)) {
+      if (mmap_fault(p, v, faulting_addr, r_scause() == 15) < 0)
+        setkilled(myproc());
+      goto out;
+    }
 
-    if(p->cow_enabled && r_scause() == 15) {
-      copy_on_write();
+    pte_t *pte = walk(p->pagetable, faulting_addr, 0);
+    if(p->cow_enabled && r_scause() == 15 && pte && (*pte & PTE_V)) {
+      copy_on_write(faulting_addr);
       goto out;
     }
     
     /* Check if the fault address is a heap page. Use p->heap_tracker */
-    bool isPageHeap = false;
     int position = -1;
     if (stval == -1) {
-      setkilled(p);
+      setkilled(myproc());
       return;
     }
     
-    for (int i = 0; i < MAXHEAP; i++)
-    {
-      if(faulting_addr != 0 && p->heap_tracker[i].addr == faulting_addr) {
-        isPageHeap = true;
-        position = i;
-        break;
-      }
-      /* code */
-    }
-    if(isPageHeap && p->heap_tracker[position].loaded == true) {
-      load_from_disk = true;
-    }
-    
-    
-    if (isPageHeap) {
+    if ((position = heap_find(p, faulting_addr)) >= 0) {
         goto heap_handle;
     }
+
     /* If it came here, it is a page from the program binary that we must load. */
 
 /* tryout area start*/
@@ -172,7 +536,6 @@ void page_fault_handler(void)
     struct proghdr ph;
     int i, off;
 
-    uint64 sz = 0;
     //trying something new here
     pagetable_t pagetable = 0x0, oldpagetable;
     begin_op();
@@ -182,13 +545,11 @@ void page_fault_handler(void)
     }
     ilock(ip);
 
-    if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
+    if(readi(ip, 0, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
     goto out;
 
-    init_psa_regions();
-    cow_init();
     for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+    if(readi(ip, 0, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto out;
     
     if(ph.type != ELF_PROG_LOAD){
@@ -214,7 +575,6 @@ void page_fault_handler(void)
         goto out;
         }
 
-        sz = sz1;
         // printf("loop intermediate: vaddr = %d, sz = %d, ph.memsz= %d\n\n", ph.vaddr, sz,ph.memsz);
         // printf("loop2 %d: phvaddr = %d, phoff = %d,ph.off = %d, ph.memsz = %d, sz = %d  \n", i,ph.vaddr, elf.phoff, ph.off, ph.memsz, sz);
         
@@ -234,45 +594,11 @@ void page_fault_handler(void)
   goto out;
 
 heap_handle:
-    /* 2.4: Check if resident pages are more than heap pages. If yes, evict. */
-    bool isHeapFull = false;
-    int heapCount = 0;
-    for (int i = 0; i < MAXHEAP; i++)
-    { 
-      if(p->heap_tracker[i].addr != 0xFFFFFFFFFFFFFFFF){
-        ++heapCount;
-      }
-    }
-    if(heapCount == MAXHEAP) {
-          // printf("\n%d %d\n", heapCount, MAXHEAP);
-          isHeapFull = true;
-    }
-    if (p->resident_heap_pages == MAXRESHEAP && !isHeapFull) {
-        evict_page_to_disk(p);
-    }
-
-    /* 2.3: Map a heap page into the process' address space. (Hint: check growproc) */
-    
-    if(sz = uvmalloc(p->pagetable, faulting_addr, faulting_addr + PGSIZE, PTE_W) == 0) {
-      return -1;
-    }
-
-    /* 2.4: Update the last load time for the loaded heap page in p->heap_tracker. */
-    if (position == -1) {
-      printf("EXEC: illegal position");
-      panic("illegal position within array");
-    }
-
-    p->heap_tracker[position].last_load_time = read_current_timestamp();
-    p->heap_tracker[position].loaded = true;
-    
-    /* 2.4: Heap page was swapped to disk previously. We must load it from disk. */
-    if (load_from_disk && !isHeapFull) {
-        retrieve_page_from_disk(p, faulting_addr);
+    if (heap_page_in(p, position, v) < 0) {
+      setkilled(myproc());
+      return;
     }
-
-    /* Track that another heap page has been brought into memory. */
-    p->resident_heap_pages++;
+    heap_readahead(p, position);
 
 out:
     /* Flush stale page table entries. This is important to always do. */
@@ -13,13 +13,30 @@ struct proc proc[NPROC];
 struct proc *initproc;
 
 int nextpid = 1;
+int nextkpid = -1;
 struct spinlock pid_lock;
 
+// Processes by pid, so that kill() and friends need not scan
+// proc[]. pid_lock protects the buckets and pidnext links; it
+// is acquired after any p->lock.
+struct proc *pidhash[NPIDHASH];
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int prio_floor(int nice);
+static void thread_reap(struct proc *p);
+static void thread_unmap(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// Processes sleeping on a channel are kept on the wait queue
+// that the channel hashes to, so wakeup() need not look at
+// every process. A queue's lock is acquired before any p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -48,11 +65,17 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->mmlock, "mm");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
@@ -89,25 +112,93 @@ myproc(void)
   return p;
 }
 
+// Give p a new pid, and enter it in the pid hash table.
+// Caller holds p->lock.
 int
-allocpid()
+allocpid(struct proc *p)
 {
   int pid;
   
   acquire(&pid_lock);
   pid = nextpid;
   nextpid = nextpid + 1;
+  p->pid = pid;
+  p->pidnext = pidhash[pid % NPIDHASH];
+  pidhash[pid % NPIDHASH] = p;
   release(&pid_lock);
 
   return pid;
 }
 
+// Give kernel thread p a pid from a sequence of its own,
+// counting down from -1, so that user processes get the same
+// pids whichever threads the kernel starts. It is not entered
+// in the pid hash table, so kill() and friends can't find it.
+// Caller holds p->lock.
+static int
+allockpid(struct proc *p)
+{
+  acquire(&pid_lock);
+  p->pid = nextkpid--;
+  p->pidnext = 0;
+  release(&pid_lock);
+
+  return p->pid;
+}
+
+// Remove p from the pid hash table. Caller holds p->lock.
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  if(p->pid < 0){
+    p->pid = 0;
+    return;
+  }
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pid = 0;
+}
+
+// Find process pid, and return it with p->lock held, or 0.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+
+  // p may have been freed, and even reused, since.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. kthread says whether p will
+// be a kernel thread, which gets a pid from its own sequence.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int kthread)
 {
   struct proc *p;
 
@@ -122,8 +213,20 @@ allocproc(void)
   return 0;
 
 found:
-  p->pid = allocpid();
+  if(kthread)
+    allockpid(p);
+  else
+    allocpid(p);
   p->state = USED;
+  p->affinity = ~0;
+  p->leader = p;
+  p->tslot = 0;
+  p->tslots = 1;
+  p->kfn = 0;
+  p->prio = 0;
+  p->nice = 0;
+  p->slice = 0;
+  p->runticks = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -158,23 +261,31 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable){
-    if(p->cow_enabled == 1){
-      proc_freepagetable_cow(p->pagetable, p->sz, p->cow_group);
-    } else {
-      proc_freepagetable(p->pagetable, p->sz);
+  // a thread's address space belongs to its leader, whose
+  // mmap regions exit() (or fork()) has already let go of,
+  // since that may sleep.
+  if(p->leader == p){
+    heap_release(p);
+    if(p->pagetable){
+      if(p->cow_enabled == 1){
+        proc_freepagetable_cow(p->pagetable, p->sz, p->cow_group);
+      } else {
+        proc_freepagetable(p->pagetable, p->sz);
+      }
     }
-    
-  }
-  if(p->cow_enabled){
-decr_cow_group_count(p->cow_group);
+    if(p->cow_enabled)
+      decr_cow_group_count(p->cow_group);
   }
   p->pagetable = 0;
+  p->leader = 0;
   p->sz = 0;
-  p->pid = 0;
-  // p->cow_enabled = 0;
-  // p->cow_group = 0;
+  if(p->pid)
+    freepid(p);
+  p->cow_enabled = 0;
+  p->cow_group = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -253,7 +364,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -269,6 +380,8 @@ userinit(void)
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
+  p->cpu = cpuid();
+  runq_add(p);
 
   release(&p->lock);
 }
@@ -295,7 +408,7 @@ growproc(int n)
 {
   uint64 sz;
   int start = -1;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
 
   /* CSE 536: (2.3) Instead of allocating pages, make these allocations
    * on-demand. Also, keep track of all allocated heap pages. 
@@ -307,6 +420,10 @@ growproc(int n)
   sz = p->sz;
   if(n > 0){
 
+    // don't grow into the mmap regions.
+    if(p->nvma > 0 && sz + n > p->vma[0].start)
+      return -1;
+
     if(p->ondemand == true){
       for(int i = sz; i<p->sz+n; i+=PGSIZE){
       int j;
@@ -356,7 +473,9 @@ growproc(int n)
       return -1;
     }
   } else if(n < 0){
-
+    // give back the swap slots and tracker entries of
+    // on-demand pages too, not just the resident frames.
+    heap_shrink(p, sz, sz + n);
     sz = uvmdealloc(p->pagetable, sz, sz + n);
 
   }
@@ -374,9 +493,12 @@ fork(int cow_enabled)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *mm = p->leader;  // owner of the address space to copy
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  mm_lock(p);
+  if((np = allocproc(0)) == 0){
+    mm_unlock(p);
     return -1;
   }
   // printf("\nFORK: initiated by pid - %d\n", p->pid);
@@ -390,10 +512,10 @@ fork(int cow_enabled)
   if(cow_enabled) {
     np->cow_enabled = 1;
     // np->cow_group = p->pid;
-    np->cow_group = p->cow_group;
-    p->cow_enabled = 1;
+    np->cow_group = mm->cow_group;
+    mm->cow_enabled = 1;
     // p->cow_group = p->pid;
-    cow_group_init(p->cow_group);
+    cow_group_init(mm->cow_group);
     // if(p->cow_group ==0) {
     //   p->cow_group = p->pid;
     // }  
@@ -405,24 +527,42 @@ fork(int cow_enabled)
   // implement and call the uvm_copy() function defined in cow.c
   // printf("\nFORK: done copying\n");
   if(cow_enabled == 1) {
-if((uvmcopy_cow(p->pagetable, np->pagetable, p->sz) < 0)) {
+if((uvmcopy_cow(mm->pagetable, np->pagetable, mm->sz) < 0)) {
     freeproc(np);
     release(&np->lock);
+    mm_unlock(p);
     return -1;
   }
   } else {
     np->cow_group = np->pid;
     np->cow_enabled = cow_enabled;
-if((uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)){
+if((uvmcopy(mm->pagetable, np->pagetable, mm->sz) < 0)){
     freeproc(np);
     release(&np->lock);
+    mm_unlock(p);
     return -1;
   }
   }
   
+  // Copy the heap tracker and mmap regions, and the
+  // pages of those regions. This may read and write the
+  // disk, so np->lock can't be held; np isn't RUNNABLE
+  // yet, so no one else will touch it.
+  release(&np->lock);
+  if(heap_copy(mm, np) < 0 || vma_copy(mm, np, cow_enabled) < 0){
+    vma_free(np);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    mm_unlock(p);
+    return -1;
+  }
+  mm_unlock(p);
+  acquire(&np->lock);
+
   // Copy user memory from parent to child.
   
-  np->sz = p->sz;
+  np->sz = mm->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -441,7 +581,7 @@ if((uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)){
   /* CSE 536: Copy the on-demand bit too. This is needed since
    * sh is always forked on any command, and it is reexecuted
    * from its forked counterpart. */
-  np->ondemand = p->ondemand;
+  np->ondemand = mm->ondemand;
 
   pid = np->pid;
 
@@ -449,10 +589,19 @@ if((uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)){
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  np->nice = p->nice;
+  np->prio = prio_floor(np->nice);
+  np->affinity = p->affinity;
+  push_off();
+  np->cpu = cpuid();
+  pop_off();
+  runq_add(np);
   release(&np->lock);
   // printf("\nFORK: parent - %d, child - %d, cow - %d\n", p->pid, pid, cow_enabled);
   return pid;
@@ -465,12 +614,17 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  for(pp = p->children; ; pp = pp->sibling){
+    pp->parent = initproc;
+    if(pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -484,6 +638,15 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  if(p->leader == p){
+    // the other threads can't outlive the address space.
+    thread_reap(p);
+    // Write back and let go of mapped files.
+    vma_free(p);
+  } else {
+    thread_unmap(p);
+  }
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -503,8 +666,16 @@ exit(int status)
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  if(p->leader == p){
+    // Parent might be sleeping in wait().
+    wakeup(p->parent);
+  } else {
+    // the slot may be reused now that the trapframe is unmapped;
+    // other threads might be sleeping in join(), or the
+    // leader in thread_reap().
+    p->leader->tslots &= ~(1 << p->tslot);
+    wakeup(p->leader);
+  }
   
   acquire(&p->lock);
 
@@ -523,41 +694,39 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *pp;
-  int havekids, pid;
+  struct proc *pp, **link;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    // Scan through p's children looking for exited ones.
+    for(link = &p->children; (pp = *link) != 0; link = &pp->sibling){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *link = pp->sibling;
+        pp->sibling = 0;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->children == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -567,6 +736,572 @@ wait(uint64 addr)
   }
 }
 
+// Threads.
+//
+// A thread made by clone() is a proc of its own, with its own
+// kernel stack and trapframe, that runs in its leader's address
+// space: p->pagetable is the leader's, and the leader's sz, heap
+// tracker and mmap regions are used in place of p's. Each
+// thread's trapframe is mapped at its own TRAPFRAMEN() slot, so
+// that the trampoline can find it in the shared page table.
+// A thread has no parent; another thread of the group collects
+// its exit status with join(), or the leader frees it in exit().
+
+// Only one thread at a time may change the address space it
+// shares with the others. Paging a heap page in reads the
+// disk, so this is a busy flag that waiters sleep on rather
+// than a spinlock.
+void
+mm_lock(struct proc *p)
+{
+  struct proc *l = p->leader;
+
+  acquire(&l->mmlock);
+  while(l->mmowner)
+    sleep(&l->mmowner, &l->mmlock);
+  l->mmowner = p;
+  release(&l->mmlock);
+}
+
+void
+mm_unlock(struct proc *p)
+{
+  struct proc *l = p->leader;
+
+  acquire(&l->mmlock);
+  if(l->mmowner != p)
+    panic("mm_unlock");
+  l->mmowner = 0;
+  wakeup(&l->mmowner);
+  release(&l->mmlock);
+}
+
+// Take p's mm_lock() only if that needn't sleep, for
+// callers holding a spinlock. Returns 1 if it did, 0 if not.
+int
+mm_trylock(struct proc *p)
+{
+  struct proc *l = p->leader;
+  int r = 0;
+
+  acquire(&l->mmlock);
+  if(l->mmowner == 0){
+    l->mmowner = p;
+    r = 1;
+  }
+  release(&l->mmlock);
+  return r;
+}
+
+// Does p hold its address space's mm_lock()?
+int
+mm_holding(struct proc *p)
+{
+  return p->leader->mmowner == p;
+}
+
+// Create a thread that starts at fn(arg) in user space with
+// stack pointer stack, sharing the caller's address space.
+// fn must not return; it ends by calling exit().
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, tid, r;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *l = p->leader;
+
+  acquire(&wait_lock);
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((l->tslots & (1 << slot)) == 0)
+      break;
+  if(slot == NTHREAD || killed(l)){
+    release(&wait_lock);
+    return -1;
+  }
+  l->tslots |= 1 << slot;
+  release(&wait_lock);
+
+  if((np = allocproc(0)) == 0)
+    goto bad;
+
+  // run in l's page table, not the one allocproc() made.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = l->pagetable;
+  np->leader = l;
+  np->tslot = slot;
+
+  // mm_lock() may sleep; np isn't RUNNABLE yet,
+  // so no one else will touch it.
+  release(&np->lock);
+  mm_lock(p);
+  r = mappages(l->pagetable, TRAPFRAMEN(slot), PGSIZE,
+               (uint64)np->trapframe, PTE_R | PTE_W);
+  mm_unlock(p);
+  acquire(&np->lock);
+  if(r < 0){
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
+  }
+
+  // start at fn(arg) on the new stack.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+  np->state = RUNNABLE;
+  np->nice = p->nice;
+  np->prio = prio_floor(np->nice);
+  np->affinity = p->affinity;
+  push_off();
+  np->cpu = cpuid();
+  pop_off();
+  runq_add(np);
+  release(&np->lock);
+  return tid;
+
+bad:
+  acquire(&wait_lock);
+  l->tslots &= ~(1 << slot);
+  release(&wait_lock);
+  return -1;
+}
+
+// Wait for thread tid of the caller's group to exit, and
+// return tid. Returns -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *pp;
+  int found;
+  struct proc *p = myproc();
+
+  acquire(&wait_lock);
+
+  for(;;){
+    found = 0;
+    if((pp = findproc(tid)) != 0){
+      found = pp->leader == p->leader && pp != p->leader && pp != p;
+      if(found && pp->state == ZOMBIE){
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
+          release(&pp->lock);
+          release(&wait_lock);
+          return -1;
+        }
+        freeproc(pp);
+        release(&pp->lock);
+        release(&wait_lock);
+        return tid;
+      }
+      release(&pp->lock);
+    }
+
+    if(!found || killed(p)){
+      release(&wait_lock);
+      return -1;
+    }
+
+    // exiting threads wake up their leader's channel.
+    sleep(p->leader, &wait_lock);
+  }
+}
+
+// Thread p is exiting; take its trapframe out of
+// the page table that it shares with its group.
+static void
+thread_unmap(struct proc *p)
+{
+  uint64 va = TRAPFRAMEN(p->tslot);
+
+  mm_lock(p);
+  uvmunmap(p->pagetable, va, 1, 0);
+  mm_unlock(p);
+}
+
+// The leader p is exiting: kill the other threads of its
+// group, wait for them to exit, and free them, since the
+// address space they run in is about to go away.
+static void
+thread_reap(struct proc *p)
+{
+  struct proc *pp;
+  int n;
+
+  acquire(&wait_lock);
+  for(;;){
+    n = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp->leader != p || pp == p)
+        continue;
+      acquire(&pp->lock);
+      if(pp->state == ZOMBIE){
+        freeproc(pp);
+      } else {
+        pp->killed = 1;
+        if(pp->state == SLEEPING){
+          pp->state = RUNNABLE;
+          runq_add(pp);
+        }
+        n++;
+      }
+      release(&pp->lock);
+    }
+    if(n == 0)
+      break;
+    sleep(p, &wait_lock);
+  }
+  release(&wait_lock);
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthread_start.
+static void
+kthread_start(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn(p->karg);
+  panic("kthread returned");
+}
+
+// Start a thread that runs fn(arg) in the kernel, and never
+// in user space. fn must not return.
+// Returns 0, or -1 if there is no free proc.
+int
+kthread_create(void (*fn)(void *), void *arg, char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc(1)) == 0)
+    return -1;
+  p->context.ra = (uint64)kthread_start;
+  p->kfn = fn;
+  p->karg = arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  p->state = RUNNABLE;
+  push_off();
+  p->cpu = cpuid();
+  pop_off();
+  runq_add(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Run queues.
+//
+// Each hart has a multi-level feedback queue of RUNNABLE
+// processes: a FIFO queue for each of NMLFQ priority levels.
+// Whoever makes a process RUNNABLE puts it on the queue for its
+// level of p->cpu, the hart it last ran on (or its parent's, for
+// a new process), so it tends to find its cache and TLB still
+// warm. A hart whose queues are empty steals from the hart with
+// the most waiting processes. A process is on a queue if and
+// only if it is RUNNABLE.
+//
+// setaffinity() restricts a process to a set of harts. runq_add()
+// moves it to one of them if its last hart isn't, and a hart
+// steals only processes that may run on it.
+//
+// A process that uses up the time slice of its level drops to
+// the next level, whose slice is twice as long. Waking up from
+// sleep() moves it back to the highest level its nice value
+// allows, so interactive processes stay ahead of CPU-bound ones.
+// Every MLFQAGE ticks, each hart moves all its waiting processes
+// to the top level so that none of them starves.
+
+// Time slice, in ticks, of priority level l.
+static int
+quantum(int l)
+{
+  return 1 << l;
+}
+
+// The highest (numerically lowest) level a process with
+// the given nice value may run at.
+static int
+prio_floor(int nice)
+{
+  return nice * NMLFQ / (NICEMAX + 1);
+}
+
+// Can p run on hart c?
+static int
+runq_allowed(struct proc *p, struct cpu *c)
+{
+  return (p->affinity >> (c - cpus)) & 1;
+}
+
+// Put p on the tail of its hart's run queue for its level,
+// and make sure some hart is awake to run it.
+// Caller must hold p->lock, and have made p RUNNABLE.
+void
+runq_add(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu], *v;
+
+  // off p's allowed harts, go to the least busy of them.
+  if(!runq_allowed(p, c)){
+    for(v = cpus; v < &cpus[NCPU]; v++)
+      if(v->online && runq_allowed(p, v) && (!runq_allowed(p, c) || v->nrun < c->nrun))
+        c = v;
+    p->cpu = c - cpus;
+  }
+
+  acquire(&c->rqlock);
+  p->rqnext = 0;
+  if(c->rqtail[p->prio])
+    c->rqtail[p->prio]->rqnext = p;
+  else
+    c->rqhead[p->prio] = p;
+  c->rqtail[p->prio] = p;
+  c->nrun++;
+  release(&c->rqlock);
+
+  // release() ordered the nrun update before these reads;
+  // idle() does the converse.
+  if(c->idle){
+    ipisend(c - cpus, IPI_WAKE);
+    return;
+  }
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v->idle && runq_allowed(p, v)){
+      ipisend(v - cpus, IPI_WAKE); // it can steal p.
+      break;
+    }
+  }
+}
+
+// Take the first process of c's highest non-empty level that
+// may run on hart t, or 0. Sets *level to the level it came from.
+static struct proc*
+runq_pop(struct cpu *c, int *level, struct cpu *t)
+{
+  struct proc *p = 0, *prev, **pp;
+  int l;
+
+  acquire(&c->rqlock);
+  for(l = 0; l < NMLFQ && p == 0; l++){
+    prev = 0;
+    for(pp = &c->rqhead[l]; (p = *pp) != 0; pp = &p->rqnext){
+      if(runq_allowed(p, t)){
+        *pp = p->rqnext;
+        if(c->rqtail[l] == p)
+          c->rqtail[l] = prev;
+        c->nrun--;
+        *level = l;
+        break;
+      }
+      prev = p;
+    }
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Is a process that may run on hart t waiting on c's queues?
+static int
+runq_any(struct cpu *c, struct cpu *t)
+{
+  struct proc *p;
+  int l, r = 0;
+
+  if(c->nrun == 0)
+    return 0;
+  acquire(&c->rqlock);
+  for(l = 0; l < NMLFQ && r == 0; l++)
+    for(p = c->rqhead[l]; p && r == 0; p = p->rqnext)
+      r = runq_allowed(p, t);
+  release(&c->rqlock);
+  return r;
+}
+
+// Move all processes waiting on c's lower levels to the top
+// level; the scheduler settles their prio when it picks them.
+static void
+runq_age(struct cpu *c)
+{
+  acquire(&c->rqlock);
+  for(int l = 1; l < NMLFQ; l++){
+    if(c->rqhead[l] == 0)
+      continue;
+    if(c->rqtail[0])
+      c->rqtail[0]->rqnext = c->rqhead[l];
+    else
+      c->rqhead[0] = c->rqhead[l];
+    c->rqtail[0] = c->rqtail[l];
+    c->rqhead[l] = c->rqtail[l] = 0;
+  }
+  c->lastage = ticks;
+  release(&c->rqlock);
+}
+
+// Choose the next process for hart c to run: the best one on
+// its own queues, or else one stolen from the busiest hart that
+// has one c may run. A hart whose processes are all pinned to it
+// is passed over for the next busiest.
+static struct proc*
+runq_take(struct cpu *c, int *level)
+{
+  struct cpu *v, *busiest;
+  struct proc *p;
+  uint tried = 0;
+
+  if(ticks - c->lastage >= MLFQAGE)
+    runq_age(c);
+
+  if(c->nrun > 0 && (p = runq_pop(c, level, c)) != 0)
+    return p;
+
+  for(;;){
+    busiest = 0;
+    for(v = cpus; v < &cpus[NCPU]; v++)
+      if(v != c && v->nrun > 0 && (tried & (1 << (v - cpus))) == 0 &&
+         (busiest == 0 || v->nrun > busiest->nrun))
+        busiest = v;
+    if(busiest == 0)
+      return 0;
+    if((p = runq_pop(busiest, level, c)) != 0)
+      return p;
+    tried |= 1 << (busiest - cpus);
+  }
+}
+
+// Nothing to run on hart c: stall it until an interrupt,
+// such as the IPI_WAKE that runq_add() sends, unless there
+// is something it may steal. Processes pinned to other harts
+// don't count, or they would keep c out of wfi.
+static void
+idle(struct cpu *c)
+{
+  struct cpu *v;
+
+  // with interrupts off, a wakeup between the check and the
+  // wfi leaves an interrupt pending, which ends the wfi.
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  for(v = cpus; v < &cpus[NCPU]; v++)
+    if(runq_any(v, c))
+      break;
+  if(v == &cpus[NCPU]){
+    tick_stop();
+    wfi();
+    tick_start();
+  }
+  c->idle = 0;
+  intr_on();
+}
+
+// Charge a timer tick to the process running on this hart.
+// Returns 1 if it should give up the CPU: it has used up its
+// time slice, or a process of a higher level is waiting.
+int
+sched_tick(void)
+{
+  struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  int l, preempt = 0;
+
+  acquire(&p->lock);
+  p->runticks++;
+  if(++p->slice >= quantum(p->prio)){
+    if(p->prio < NMLFQ - 1)
+      p->prio++;
+    p->slice = 0;
+    preempt = 1;
+  }
+  for(l = 0; l < p->prio; l++)
+    if(c->rqhead[l])
+      preempt = 1;
+  release(&p->lock);
+  return preempt;
+}
+
+// Set the nice value of process pid.
+// Returns 0, or -1 if there is no such process.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < 0 || nice > NICEMAX)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->nice = nice;
+  if(p->prio < prio_floor(nice)){
+    p->prio = prio_floor(nice);
+    p->slice = 0;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Restrict process pid to the harts in mask, which must
+// include a running one. It moves when it next waits to run.
+// Returns 0, or -1.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online && ((mask >> (c - cpus)) & 1))
+      break;
+  if(c == &cpus[NCPU])
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  release(&p->lock);
+  return 0;
+}
+
+// The affinity mask of process pid, or -1.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  mask = p->affinity & ((1 << NCPU) - 1);
+  release(&p->lock);
+  return mask;
+}
+
+// The nice value of process pid, or -1.
+int
+getpriority(int pid)
+{
+  struct proc *p;
+  int nice;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  nice = p->nice;
+  release(&p->lock);
+  return nice;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -579,28 +1314,44 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int level;
   
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    if((p = runq_take(c, &level)) == 0){
+      idle(c);
+      continue;
+    }
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && !runq_allowed(p, c)){
+      // setaffinity() moved it off this hart while it was queued.
+      runq_add(p);
+    } else if(p->state == RUNNABLE) {
+      // it may have been moved up by runq_age().
+      if(level < prio_floor(p->nice))
+        level = prio_floor(p->nice);
+      if(level != p->prio){
+        p->prio = level;
+        p->slice = 0;
       }
-      release(&p->lock);
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = c - cpus;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -638,6 +1389,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  runq_add(p);
   sched();
   release(&p->lock);
 }
@@ -663,26 +1415,63 @@ forkret(void)
   usertrapret();
 }
 
+static struct waitq*
+waitq_for(void *chan)
+{
+  return &waitq[((uint64)chan >> 3) % NWAITQ];
+}
+
+// Put p on wq, sleeping on chan.
+// Caller holds wq->lock and p->lock.
+static void
+waitq_add(struct waitq *wq, struct proc *p, void *chan)
+{
+  p->chan = chan;
+  p->state = SLEEPING;
+  p->wq = wq;
+  p->wqnext = wq->head;
+  wq->head = p;
+}
+
+// Take p off its wait queue, if it is still on it.
+// Caller holds p->wq->lock.
+static void
+waitq_remove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &p->wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      break;
+    }
+  }
+  p->wq = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitq_for(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are on chan's wait queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue, then p->lock),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
-  release(lk);
 
   // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
+  waitq_add(wq, p, chan);
+
+  release(&wq->lock);
+  release(lk);
 
   /* Adil: sleeping. */
   // printf("Sleeping and yielding CPU.");
@@ -691,28 +1480,118 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // kill() doesn't take p off the wait queue.
+  acquire(&wq->lock);
+  if(p->wq)
+    waitq_remove(p);
+  release(&wq->lock);
 
   // Reacquire original lock.
+  acquire(lk);
+}
+
+// Like sleep(), but also wake up after n ticks.
+// Returns -1 if the time ran out, 0 otherwise.
+int
+sleep_timeout(void *chan, struct spinlock *lk, int n)
+{
+  struct proc *p = myproc();
+  struct waitq *wq = waitq_for(chan);
+  uint deadline;
+  int expired;
+
+  // clockintr() holds tickslock to fire timers, so it can't
+  // wakeup(chan) before p is on chan's wait queue.
+  acquire(&tickslock);
+  deadline = ticks + n;
+  timer_add(p, deadline, chan);
+  acquire(&wq->lock);
+  acquire(&p->lock);
+  waitq_add(wq, p, chan);
+  release(&wq->lock);
+  release(&tickslock);
+  release(lk);
+
+  sched();
+
+  p->chan = 0;
   release(&p->lock);
+
+  acquire(&wq->lock);
+  if(p->wq)
+    waitq_remove(p);
+  release(&wq->lock);
+
+  acquire(&tickslock);
+  expired = (int)(ticks - deadline) >= 0;
+  timer_del(p);
+  release(&tickslock);
+
   acquire(lk);
+  return expired ? -1 : 0;
 }
 
-// Wake up all processes sleeping on chan.
+// Make p, sleeping on its wait queue, RUNNABLE.
+// Caller holds p->wq->lock and p->lock.
+static void
+waitq_wake(struct proc *p)
+{
+  waitq_remove(p);
+  p->state = RUNNABLE;
+  p->prio = prio_floor(p->nice);
+  p->slice = 0;
+  runq_add(p);
+}
+
+// Wake up at most n processes sleeping on chan.
+// Returns the number woken.
 // Must be called without any p->lock.
-void
-wakeup(void *chan)
+int
+wakeup_n(void *chan, int n)
 {
-  struct proc *p;
+  struct waitq *wq = waitq_for(chan);
+  struct proc *p, *next;
+  int woken = 0;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+  acquire(&wq->lock);
+  for(p = wq->head; p && woken < n; p = next) {
+    next = p->wqnext;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      waitq_wake(p);
+      woken++;
     }
+    release(&p->lock);
   }
+  release(&wq->lock);
+  return woken;
+}
+
+// Wake up p alone, if it is still sleeping on chan, for an
+// expired timer: others sleeping on chan, such as the rest of
+// a futex's waiters, must not see a spurious wakeup.
+// Must be called without any p->lock.
+void
+wakeup_proc(struct proc *p, void *chan)
+{
+  struct waitq *wq = waitq_for(chan);
+
+  acquire(&wq->lock);
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    waitq_wake(p);
+  release(&p->lock);
+  release(&wq->lock);
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
+{
+  wakeup_n(chan, NPROC);
 }
 
 // Kill the process with the given pid.
@@ -723,20 +1602,16 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
+    runq_add(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -813,7 +1688,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s prio %d nice %d ticks %d", p->pid, state, p->name,
+           p->prio, p->nice, (int)p->runticks);
     printf("\n");
   }
 }
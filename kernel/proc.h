@@ -27,10 +27,38 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  pagetable_t volatile upagetable; // User page table loaded while in user space, or 0.
+  uint ipi;                   // Pending IPI_* requests from other harts.
+  volatile int tlb_pending;   // Set by a shootdown sender until this hart flushes.
+
+  // RUNNABLE processes waiting for this hart, one queue per priority level.
+  struct spinlock rqlock;     // protects the fields below
+  struct proc *rqhead[NMLFQ]; // next to run at each level
+  struct proc *rqtail[NMLFQ];
+  int nrun;                   // # of processes on the queues; read without rqlock when stealing
+  uint lastage;               // ticks at the last boost of this hart's queues
+  volatile int idle;          // In wfi, waiting for an IPI_WAKE or other interrupt.
+  int online;                 // Has entered scheduler().
 };
 
 extern struct cpu cpus[NCPU];
 
+// Reasons for an inter-processor interrupt (ipi.c).
+#define IPI_TLB  (1 << 0)     // flush the addresses in the current shootdown
+#define IPI_WAKE (1 << 1)     // there is work on a run queue; leave wfi
+
+// Addresses whose PTEs were changed, collected so that other
+// harts can be told to flush them with a single IPI, and the
+// pages they mapped, which can't be freed until after the flush.
+// n < 0 means "too many; flush everything".
+struct tlbgather {
+  pagetable_t pagetable;
+  int n;
+  uint64 va[TLBBATCH];
+  int nfree;
+  void *free[TLBBATCH];
+};
+
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
 // user page table. not specially mapped in the kernel page table.
@@ -90,6 +118,17 @@ struct heap_tracker_t {
   uint64 last_load_time;        // when the page was loaded into memory
   bool   loaded;                // has the heap page been loaded yet
   int    startblock;            // if located in disk, the starting block
+  int    advice;                // MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL
+};
+
+// A region of user memory created by mmap().
+struct vma {
+  uint64 start;                 // first address, page-aligned
+  uint64 end;                   // one past the last address
+  int prot;                     // PROT_* from fcntl.h
+  int flags;                    // MAP_* from fcntl.h
+  struct file *file;            // backing file, or 0 if anonymous
+  uint64 off;                   // file offset that start maps
 };
 
 // Per-process state
@@ -99,15 +138,46 @@ struct proc {
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   void *chan;                  // If non-zero, sleeping on chan
+  struct waitq *wq;            // Wait queue p is on, or 0 (its lock)
+  struct proc *wqnext;         // Next on that wait queue (its lock)
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  struct proc *pidnext;        // Next in pid's hash bucket (pid_lock)
+  int cpu;                     // Hart whose run queue p goes on when RUNNABLE
+  uint affinity;               // Harts p may run on, one bit each; read without p->lock when stealing
+  int prio;                    // Scheduling level, 0 (highest) to NMLFQ-1
+  int nice;                    // 0 to NICEMAX; limits how high prio may go
+  int slice;                   // Ticks run at the current level
+  uint64 runticks;             // Ticks run in total
+  struct proc *rqnext;         // Next on that run queue (its rqlock)
+
+  // tickslock must be held when using these:
+  uint deadline;               // ticks at which to wake p from tchan
+  void *tchan;
+  struct proc *tnext;          // Next on the timer queue, which is sorted by deadline
+  int tqueued;                 // On the timer queue?
 
-  // wait_lock must be held when using this:
-  struct proc *parent;         // Parent process
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process, or 0 for a thread
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
+  uint tslots;                 // Trapframe slots in use, if p is a group leader
+
+  // mm_lock() comes before the log and inode locks, since faults
+  // on mmap()ed files read them in with pcache_get(); so nothing
+  // may fault on user memory while holding an inode lock, and
+  // fileread()/filewrite() copy through a kernel buffer.
+  // mmlock must be held when using this:
+  struct spinlock mmlock;
+  struct proc *mmowner;        // Thread in the middle of changing the address space
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
+  struct proc *leader;         // Owner of the address space: p, unless made by clone()
+  int tslot;                   // p->trapframe is mapped at TRAPFRAMEN(tslot)
+  void (*kfn)(void *);         // Kernel thread's function, or 0
+  void *karg;
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
@@ -120,6 +190,10 @@ struct proc {
   bool                    ondemand;
   struct heap_tracker_t   heap_tracker[MAXHEAP];
   int                     resident_heap_pages;
+
+  struct vma vma[NVMA];        // mmap regions, sorted by start
+  int nvma;                    // number of entries in vma[]
+  int vmahint;                 // index of the last region found
   
   int cow_group;               // The group of processes sharing memory
   int cow_enabled;             // CoW enabled
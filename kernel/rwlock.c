@@ -0,0 +1,127 @@
+// Reader-writer spin locks and sequence locks, for read-mostly
+// data that would otherwise make concurrent readers take turns
+// on an exclusive spinlock.
+//
+// An rwlock lets any number of readers in at once, or a single
+// writer. A writer that is waiting keeps new readers out, so a
+// steady stream of readers can't starve it; so a reader must not
+// acquire a read lock it already holds. Like spinlocks, rwlocks
+// are held with interrupts off.
+//
+// A seqlock never makes readers wait for each other, or write to
+// shared memory at all. A writer makes the sequence number odd
+// while it updates the data; a reader notes the sequence number,
+// copies the data, and tries again if the number was odd or has
+// since changed. Writers serialize on some other lock of their
+// own, such as tickslock for ticks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  rw->name = name;
+  rw->cnt = 0;
+  rw->wwait = 0;
+}
+
+void
+acquireread(struct rwlock *rw)
+{
+  int c;
+
+  push_off();
+  for(;;){
+    while(__atomic_load_n(&rw->wwait, __ATOMIC_RELAXED) != 0 ||
+          (c = __atomic_load_n(&rw->cnt, __ATOMIC_RELAXED)) < 0)
+      ;
+    if(__atomic_compare_exchange_n(&rw->cnt, &c, c + 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  if(__atomic_fetch_sub(&rw->cnt, 1, __ATOMIC_RELEASE) <= 0)
+    panic("releaseread");
+  pop_off();
+}
+
+void
+acquirewrite(struct rwlock *rw)
+{
+  int c;
+
+  push_off();
+  __atomic_fetch_add(&rw->wwait, 1, __ATOMIC_RELAXED);
+  for(;;){
+    while(__atomic_load_n(&rw->cnt, __ATOMIC_RELAXED) != 0)
+      ;
+    c = 0;
+    if(__atomic_compare_exchange_n(&rw->cnt, &c, -1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+  __atomic_fetch_sub(&rw->wwait, 1, __ATOMIC_RELAXED);
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  if(__atomic_load_n(&rw->cnt, __ATOMIC_RELAXED) != -1)
+    panic("releasewrite");
+  __atomic_store_n(&rw->cnt, 0, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  sl->name = name;
+  sl->seq = 0;
+}
+
+// Start a read; returns the sequence number to pass to
+// read_seqretry().
+uint
+read_seqbegin(struct seqlock *sl)
+{
+  uint s;
+
+  while((s = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+    ;
+  return s;
+}
+
+// Finish a read that started at sequence number s. Returns
+// nonzero if a writer got in the way and the read must be
+// done again.
+int
+read_seqretry(struct seqlock *sl, uint s)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != s;
+}
+
+// Caller holds the lock that serializes writers.
+void
+write_seqbegin(struct seqlock *sl)
+{
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+write_seqend(struct seqlock *sl)
+{
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,17 @@
+// Reader-writer spin lock: any number of readers, or one writer.
+struct rwlock {
+  int cnt;           // readers holding the lock, or -1 if a writer does
+  uint wwait;        // writers waiting; new readers hold off while nonzero
+
+  // For debugging:
+  char *name;        // Name of lock.
+};
+
+// Sequence lock, for data that is read far more often than it is
+// written. Writers must already be serialized by some other lock.
+struct seqlock {
+  uint seq;          // odd while a write is in progress
+
+  // For debugging:
+  char *name;        // Name of lock.
+};
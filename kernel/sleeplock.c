@@ -16,17 +16,26 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->stat = LOCKSTAT ? lockstat_find(name) : 0;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0 = LOCKSTAT ? r_time() : 0;
+  int contended = 0;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    contended = 1;
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  if(LOCKSTAT){
+    lk->tacquired = r_time();
+    lockstat_acquired(lk->stat, contended, lk->tacquired - t0);
+  }
   release(&lk->lk);
 }
 
@@ -34,6 +43,8 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(LOCKSTAT)
+    lockstat_released(lk->stat, r_time() - lk->tacquired);
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
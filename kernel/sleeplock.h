@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For profiling (lockstat.c):
+  struct lockstat *stat;
+  uint64 tacquired;
 };
 
@@ -1,4 +1,19 @@
 // Mutual exclusion spin locks.
+//
+// Three implementations of the same interface, chosen when the
+// kernel is built (LOCKTYPE in spinlock.h):
+//
+// LOCK_TAS spins reading lk->locked until it looks free, and only
+// then tries the atomic swap, so waiters spin in their own caches
+// rather than bouncing the line between harts with writes. It is
+// not fair: whichever hart swaps first after a release wins.
+//
+// LOCK_TICKET hands out tickets with an atomic add, and lets
+// them in in order, so no hart waits for more than NCPU-1 others.
+//
+// LOCK_MCS queues waiters on per-cpu nodes, and each spins on a
+// flag in its own node, so a release disturbs only the next
+// waiter's cache. lk->locked is then just a note for holding().
 
 #include "types.h"
 #include "param.h"
@@ -8,12 +23,41 @@
 #include "proc.h"
 #include "defs.h"
 
+#if LOCKTYPE == LOCK_MCS
+// Queue nodes for the MCS locks each cpu holds or waits for.
+// Only used with interrupts off, so only by the owning cpu.
+#define NMCSNODE 16
+static struct mcsnode mcsnodes[NCPU][NMCSNODE];
+
+static struct mcsnode*
+mcs_alloc(void)
+{
+  struct mcsnode *n;
+
+  for(n = mcsnodes[cpuid()]; n < &mcsnodes[cpuid()][NMCSNODE]; n++){
+    if(!n->busy){
+      n->busy = 1;
+      return n;
+    }
+  }
+  panic("mcs_alloc");
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+#if LOCKTYPE == LOCK_TICKET
+  lk->next = 0;
+  lk->owner = 0;
+#elif LOCKTYPE == LOCK_MCS
+  lk->tail = 0;
+  lk->node = 0;
+#endif
   lk->cpu = 0;
+  lk->stat = LOCKSTAT ? lockstat_find(name) : 0;
 }
 
 // Acquire the lock.
@@ -21,16 +65,45 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int contended = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+  uint64 t0 = LOCKSTAT ? r_time() : 0;
+
+#if LOCKTYPE == LOCK_TICKET
+  uint t = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != t)
+    contended = 1;
+  lk->locked = 1;
+#elif LOCKTYPE == LOCK_MCS
+  struct mcsnode *n = mcs_alloc(), *pred;
+
+  n->next = 0;
+  n->wait = 1;
+  pred = __atomic_exchange_n(&lk->tail, n, __ATOMIC_ACQ_REL);
+  if(pred){
+    contended = 1;
+    __atomic_store_n(&pred->next, n, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&n->wait, __ATOMIC_ACQUIRE))
+      ;
+  }
+  lk->node = n;
+  lk->locked = 1;
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // Try it only when the lock looks free.
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    contended = 1;
+    while(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED))
+      ;
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +113,11 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  if(LOCKSTAT){
+    lk->tacquired = r_time();
+    lockstat_acquired(lk->stat, contended, lk->tacquired - t0);
+  }
 }
 
 // Release the lock.
@@ -49,6 +127,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(LOCKSTAT)
+    lockstat_released(lk->stat, r_time() - lk->tacquired);
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +140,28 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#if LOCKTYPE == LOCK_TICKET
+  lk->locked = 0;
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+#elif LOCKTYPE == LOCK_MCS
+  struct mcsnode *n = lk->node, *next, *expect = n;
+
+  lk->locked = 0;
+  if(__atomic_load_n(&n->next, __ATOMIC_ACQUIRE) == 0){
+    // no one waiting, unless a waiter has swapped itself
+    // into lk->tail but not yet linked itself to n.
+    if(__atomic_compare_exchange_n(&lk->tail, &expect, 0, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+      n->busy = 0;
+      pop_off();
+      return;
+    }
+  }
+  while((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0)
+    ;
+  __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+  n->busy = 0;
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +170,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
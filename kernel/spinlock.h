@@ -1,9 +1,35 @@
+// Kinds of spin lock; make LOCK=tas|ticket|mcs picks one.
+#define LOCK_TAS    0  // test-and-test-and-set on one word
+#define LOCK_TICKET 1  // FIFO tickets; waiters spin reading the owner
+#define LOCK_MCS    2  // FIFO queue; each waiter spins on its own node
+#ifndef LOCKTYPE
+#define LOCKTYPE    LOCK_TICKET
+#endif
+
+// A waiter's place in an MCS lock's queue.
+struct mcsnode {
+  struct mcsnode *next;  // next waiter, once it has linked itself in
+  int wait;              // cleared by the predecessor to hand over the lock
+  int busy;              // in use by its cpu
+};
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+#if LOCKTYPE == LOCK_TICKET
+  uint next;         // next ticket to hand out
+  uint owner;        // ticket now allowed in
+#elif LOCKTYPE == LOCK_MCS
+  struct mcsnode *tail;  // last waiter, or the holder if none
+  struct mcsnode *node;  // the holder's node
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For profiling (lockstat.c):
+  struct lockstat *stat;  // counters for locks with this name
+  uint64 tacquired;       // r_time() when acquired
 };
 
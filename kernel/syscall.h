@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_msync  24
+#define SYS_madvise 25
+#define SYS_setpriority 26
+#define SYS_getpriority 27
+#define SYS_clone  28
+#define SYS_join   29
+#define SYS_futex_wait 30
+#define SYS_futex_wake 31
+#define SYS_setaffinity 32
+#define SYS_getaffinity 33
+#define SYS_getlockstat 34
+#define SYS_bcachestat 35
+#define SYS_fsync  36
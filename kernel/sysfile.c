@@ -107,6 +107,26 @@ sys_close(void)
   return 0;
 }
 
+// Wait until the changes to an open file are on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  struct inode *ip;
+  uint tid;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE && f->type != FD_DEVICE)
+    return -1;
+  ip = f->ip;
+  ilock(ip);
+  tid = ip->tid;
+  iunlock(ip);
+  log_force(tid);
+  return 0;
+}
+
 uint64
 sys_fstat(void)
 {
@@ -177,7 +197,7 @@ isdirempty(struct inode *dp)
   struct dirent de;
 
   for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    if(readi(dp, 0, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
     if(de.inum != 0)
       return 0;
@@ -355,6 +375,7 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    memset(&f->ra, 0, sizeof(f->ra));
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -503,3 +524,74 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f = 0;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(len <= 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  mm_lock(myproc());
+  addr = mmap(addr, len, prot, flags, f, off);
+  mm_unlock(myproc());
+  return addr;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len, r;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  mm_lock(myproc());
+  r = munmap(addr, len);
+  mm_unlock(myproc());
+  return r;
+}
+
+uint64
+sys_msync(void)
+{
+  uint64 addr;
+  int len, r;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  mm_lock(myproc());
+  r = msync(addr, len);
+  mm_unlock(myproc());
+  return r;
+}
+
+uint64
+sys_madvise(void)
+{
+  uint64 addr;
+  int len, advice, r;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  argint(2, &advice);
+  if(len <= 0)
+    return -1;
+  mm_lock(myproc());
+  r = madvise(addr, len, advice);
+  mm_unlock(myproc());
+  return r;
+}
@@ -41,11 +41,15 @@ uint64
 sys_sbrk(void)
 {
   uint64 addr;
-  int n;
+  int n, r;
+  struct proc *p = myproc();
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  mm_lock(p);
+  addr = p->leader->sz;
+  r = growproc(n);
+  mm_unlock(p);
+  if(r < 0)
     return -1;
 
   return addr;
@@ -56,16 +60,21 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct proc *p = myproc();
 
   argint(0, &n);
   acquire(&tickslock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
-    if(killed(myproc())){
+    if(killed(p)){
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    // clockintr() wakes us at the deadline, rather than
+    // every sleeper at every tick.
+    timer_add(p, ticks0 + n, &p->deadline);
+    sleep(&p->deadline, &tickslock);
+    timer_del(p);
   }
   release(&tickslock);
   return 0;
@@ -80,15 +89,115 @@ sys_kill(void)
   return kill(pid);
 }
 
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setpriority(pid, nice);
+}
+
+uint64
+sys_getpriority(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getpriority(pid);
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getaffinity(pid);
+}
+
+uint64
+sys_getlockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return getlockstat(addr, n);
+}
+
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return bcachestat(addr);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  argint(0, &tid);
+  argaddr(1, &p);
+  return join(tid, p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val, timeout;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  argint(2, &timeout);
+  return futex_wait(addr, val, timeout);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n <= 0)
+    return 0;
+  return futex_wake(addr, n);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return readticks();
 }
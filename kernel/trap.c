@@ -3,12 +3,25 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "defs.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+// Lets readticks() read ticks without tickslock; clockintr()
+// updates ticks inside it, holding tickslock.
+struct seqlock tickseq;
+
+// Processes waiting for ticks to reach a deadline, soonest
+// first. Protected by tickslock.
+struct proc *timerq;
+
+// The last tick a hart has claimed in clockintr(), to advance
+// ticks and fire timers. Updated with compare-and-swap.
+uint lasttick;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,10 +29,28 @@ void kernelvec();
 
 extern int devintr();
 
+// start.c; timer_scratch[hart][6] is set by timervec on each tick.
+extern uint64 timer_scratch[NCPU][7];
+
 void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  initseqlock(&tickseq, "time");
+}
+
+// The current ticks, without waiting for tickslock, which
+// the clock interrupt takes on each new tick.
+uint
+readticks(void)
+{
+  uint s, t;
+
+  do {
+    s = read_seqbegin(&tickseq);
+    t = ticks;
+  } while(read_seqretry(&tickseq, s));
+  return t;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -47,6 +78,10 @@ usertrap(void)
 
   struct proc *p = myproc();
 
+  // uservec flushed the TLB when it switched to the kernel
+  // page table, so this hart no longer caches user mappings.
+  mycpu()->upagetable = 0;
+
   /* CSE 536: (2.2) Intercept page faults and redirect them to the fault handler. */
 
   // save user program counter.
@@ -72,7 +107,9 @@ usertrap(void)
   } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
     //  syscall();
       // printf("\nTRAP: entered else %d and %d and %d and size - %d\n", r_scause(), p->cow_enabled, p->pid, p->sz);
+    mm_lock(p);
     page_fault_handler();
+    mm_unlock(p);
     
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
@@ -84,8 +121,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt
+  // and the process's time slice is over.
+  if(which_dev == 2 && sched_tick())
     yield();
   // printf("\nreaching usertrapret\n");
   usertrapret();
@@ -130,11 +168,17 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // let tlb_shootdown() know this hart may cache p's mappings
+  // from now on. the fence orders this store before userret
+  // reads any PTEs.
+  mycpu()->upagetable = p->pagetable;
+  __sync_synchronize();
+
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, TRAPFRAMEN(p->tslot));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -158,8 +202,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) {
+  // give up the CPU if this is a timer interrupt
+  // and the process's time slice is over.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && sched_tick()) {
     /* Adil: debugging */
     // printf("Yielding CPU.\n");
     yield();
@@ -171,12 +216,94 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Arrange for wakeup(chan) when ticks reaches deadline.
+// p will usually sleep on chan next, and must call timer_del()
+// when it wakes up. Caller must hold tickslock.
+void
+timer_add(struct proc *p, uint deadline, void *chan)
+{
+  struct proc **pp;
+
+  p->deadline = deadline;
+  p->tchan = chan;
+  for(pp = &timerq; *pp && (int)((*pp)->deadline - deadline) <= 0; pp = &(*pp)->tnext)
+    ;
+  p->tnext = *pp;
+  *pp = p;
+  p->tqueued = 1;
+}
+
+// Cancel p's timer, if it hasn't expired.
+// Caller must hold tickslock.
+void
+timer_del(struct proc *p)
+{
+  struct proc **pp;
+
+  if(!p->tqueued)
+    return;
+  for(pp = &timerq; *pp != p; pp = &(*pp)->tnext)
+    ;
+  *pp = p->tnext;
+  p->tqueued = 0;
+}
+
+// Stop this hart's periodic tick while it is idle: have the
+// CLINT interrupt it at the earliest timer deadline instead,
+// or never. Harts that are running keep ticking, and take care
+// of timers added in the meantime.
+void
+tick_stop(void)
+{
+  // "never", with room for timervec to add TICKINTERVAL.
+  uint64 when = ~0ULL >> 1;
+
+  if(!TICKLESS)
+    return;
+  acquire(&tickslock);
+  if(timerq)
+    when = (uint64)timerq->deadline * TICKINTERVAL;
+  release(&tickslock);
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Resume periodic ticks after tick_stop().
+void
+tick_start(void)
+{
+  if(!TICKLESS)
+    return;
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) =
+    *(volatile uint64*)CLINT_MTIME + TICKINTERVAL;
+}
+
+// Called on every hart's tick. Harts skip ticks while idle,
+// so ticks is computed from the CLINT's clock rather than
+// counted. The first hart to see a new tick claims it and
+// advances ticks and the timer queue; the others leave
+// tickslock alone.
 void
 clockintr()
 {
+  struct proc *p;
+  uint now, last;
+
+  now = *(volatile uint64*)CLINT_MTIME / TICKINTERVAL;
+  last = lasttick;
+  if((int)(now - last) <= 0 || !__sync_bool_compare_and_swap(&lasttick, last, now))
+    return;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if((int)(now - ticks) > 0){
+    write_seqbegin(&tickseq);
+    ticks = now;
+    write_seqend(&tickseq);
+  }
+  while((p = timerq) != 0 && (int)(p->deadline - ticks) <= 0){
+    timerq = p->tnext;
+    p->tqueued = 0;
+    wakeup_proc(p, p->tchan);
+  }
   release(&tickslock);
 }
 
@@ -213,17 +340,21 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip. do it first, so that an IPI
+    // that arrives while we handle this one isn't lost.
     w_sip(r_sip() & ~2);
 
+    ipiintr();
+
+    if(__sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0) == 0)
+      return 1;
+
+    clockintr();
+
     return 2;
   } else {
     return 0;
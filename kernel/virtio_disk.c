@@ -19,6 +19,9 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// most bufs merged into one request.
+#define MAXMERGE 16
+
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
@@ -46,10 +49,14 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // first of the request's bufs, through qnext
     char status;
   } info[NUM];
 
+  // requests not yet sent to the device, through qnext,
+  // sorted by block number.
+  struct buf *queue;
+
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
@@ -178,7 +185,6 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -196,12 +202,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous),
+// or none if there aren't enough free.
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,88 +218,169 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Send as many queued requests to the device as there are
+// descriptors for. Each run of queued bufs for consecutive
+// blocks in the same direction (up to MAXMERGE of them) goes as
+// one request, with a data descriptor per buf.
+// Caller holds vdisk_lock.
+static void
+virtio_disk_start(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  struct buf *b, *e;
+  int idx[MAXMERGE+2];
+  int n, i, started = 0;
+
+  while((b = disk.queue) != 0){
+    n = 1;
+    for(e = b; e->qnext && n < MAXMERGE; e = e->qnext, n++){
+      if(e->qnext->blockno != e->blockno + 1 || e->qnext->qwrite != b->qwrite)
+        break;
+    }
 
-  acquire(&disk.vdisk_lock);
+    // the spec's Section 5.2 says that legacy block operations use
+    // a descriptor for type/reserved/sector, then the data, then
+    // one for a 1-byte status result.
+    if(allocn_desc(idx, n+2) < 0)
+      break;   // virtio_disk_intr() will call again.
+    disk.queue = e->qnext;
+    e->qnext = 0;
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+    // format the descriptors.
+    // qemu's virtio-blk.c reads them.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
+    struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+
+    if(b->qwrite)
+      buf0->type = VIRTIO_BLK_T_OUT; // write the disk
+    else
+      buf0->type = VIRTIO_BLK_T_IN; // read the disk
+    buf0->reserved = 0;
+    buf0->sector = b->blockno * (BSIZE / 512);
+
+    disk.desc[idx[0]].addr = (uint64) buf0;
+    disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
+    disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
+    disk.desc[idx[0]].next = idx[1];
+
+    for(i = 1, e = b; e; i++, e = e->qnext){
+      disk.desc[idx[i]].addr = (uint64) e->data;
+      disk.desc[idx[i]].len = BSIZE;
+      if(b->qwrite)
+        disk.desc[idx[i]].flags = 0; // device reads e->data
+      else
+        disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes e->data
+      disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+      disk.desc[idx[i]].next = idx[i+1];
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+
+    disk.info[idx[0]].status = 0xff; // device writes 0 on success
+    disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+    disk.desc[idx[n+1]].len = 1;
+    disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+    disk.desc[idx[n+1]].next = 0;
+
+    // record the bufs, linked through qnext, for virtio_disk_intr().
+    disk.info[idx[0]].b = b;
+
+    // tell the device the first index in our chain of descriptors.
+    disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+
+    __sync_synchronize();
+
+    // tell the device another avail ring entry is available.
+    disk.avail->idx += 1; // not % NUM ...
+    started = 1;
   }
 
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
-
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
-
-  if(write)
-    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
-  else
-    buf0->type = VIRTIO_BLK_T_IN; // read the disk
-  buf0->reserved = 0;
-  buf0->sector = sector;
-
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  if(started){
+    __sync_synchronize();
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  }
+}
 
-  // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+// Queue a request to read or write b, in order of block
+// number, and return without waiting for the disk. Queued
+// requests go to the disk when someone calls
+// virtio_disk_wait() or virtio_disk_kick(), or another request
+// finishes, so that requests for neighbouring blocks made in
+// the meantime can be merged.
+// The caller must hold b locked until the request finishes:
+// virtio_disk_wait() waits for that, or if b->iodone is set,
+// virtio_disk_intr() calls it instead.
+void
+virtio_disk_submit(struct buf *b, int write)
+{
+  struct buf **pp;
 
-  __sync_synchronize();
+  acquire(&disk.vdisk_lock);
+  b->disk = 1;
+  b->qwrite = write;
+  for(pp = &disk.queue; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  release(&disk.vdisk_lock);
+}
 
-  // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+// Send queued requests to the disk.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  virtio_disk_start();
+  release(&disk.vdisk_lock);
+}
 
-  __sync_synchronize();
+static void virtio_disk_complete(int);
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// Wait for b's request to finish. With DISKPOLL, first watch
+// the used ring for up to DISKPOLL microseconds, and handle
+// completions without waiting for the interrupt and a context
+// switch; a request that takes longer sleeps as usual, and
+// virtio_disk_intr() wakes it.
+void
+virtio_disk_wait(struct buf *b)
+{
+  uint64 deadline;
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  acquire(&disk.vdisk_lock);
+  virtio_disk_start();
+  if(DISKPOLL > 0 && b->disk == 1){
+    release(&disk.vdisk_lock);
+    deadline = r_time() + (uint64)DISKPOLL * (TIMERFREQ / 1000000);
+    while(__atomic_load_n(&b->disk, __ATOMIC_ACQUIRE) == 1 && r_time() < deadline){
+      if(__atomic_load_n(&disk.used->idx, __ATOMIC_ACQUIRE) != disk.used_idx)
+        virtio_disk_complete(0);
+    }
+    acquire(&disk.vdisk_lock);
+  }
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
+  virtio_disk_complete(1);
+}
+
+// Handle finished requests, from the interrupt or from a
+// polling virtio_disk_wait().
+static void
+virtio_disk_complete(int intr)
+{
+  struct buf *b, *done[NUM];
+  int ndone = 0;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -301,8 +388,10 @@ virtio_disk_intr()
   // this may race with the device writing new entries to
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  // in the next interrupt, which is harmless. the same goes for
+  // entries that a poller processes first.
+  if(intr)
+    *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
@@ -316,12 +405,25 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    for(b = disk.info[id].b; b; b = b->qnext){
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone)
+        done[ndone++] = b;
+      else
+        wakeup(b);
+    }
+    disk.info[id].b = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
 
+  // the descriptors just freed can take queued requests.
+  virtio_disk_start();
+
   release(&disk.vdisk_lock);
+
+  // completion callbacks may take buffer cache locks.
+  for(int i = 0; i < ndone; i++)
+    done[i]->iodone(done[i]);
 }
@@ -34,6 +34,10 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, so that harts can send each other
+  // software interrupts (see ipi.c).
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -173,21 +177,24 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
-  struct proc* p = myproc();
+  // the CoW group is the address space owner's, not a thread's.
+  struct proc* p = myproc()->leader;
+  struct tlbgather tg;
   // printf("\nUVUNMAP: p->pid = %d, \n", p->pid);
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  tlb_gather_init(&tg, pagetable);
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue; // never touched, e.g. part of an mmap region.
     if((*pte & PTE_V) == 0)
       continue;
       /* CSE 536: removed for on-demand allocation. */
@@ -201,15 +208,17 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       // Make sure that the shared pages, belonging to a CoW group, are not freed twice
       if(p->cow_enabled) {
         if(get_cow_group_count(p->cow_group) == 1){
-        kfree((void*)pa);
+        tlb_gather_free(&tg, (void*)pa);
         }       
       } else {
-        kfree((void*)pa);
+        tlb_gather_free(&tg, (void*)pa);
       }
       
     }
     *pte = 0;
+    tlb_gather_add(&tg, a);
   }
+  tlb_gather_flush(&tg);
 }
 
 // create an empty user page table.
@@ -351,10 +360,10 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    // on-demand pages that were never loaded, or are swapped
+    // out (heap_copy() handles those), have nothing to copy.
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
     if((mem = kalloc()) == 0)
@@ -397,6 +406,7 @@ uvminvalid(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvminvalid");
   *pte &= ~PTE_V;
+  tlb_shootdown(pagetable, &va, 1);
 }
 
 // Copy from kernel to user.
@@ -406,13 +416,22 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0){
+    if(va0 >= MAXVA)
       return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W)){
+      // not resident, or clean, copy-on-write, or read-only.
+      if(vmfault(pagetable, va0, 1) == 0)
+        return -1;
+      pte = walk(pagetable, va0, 0);
     }
+    pa0 = PTE2PA(*pte);
+    // as the MMU would, so that msync() sees the store.
+    *pte |= PTE_D;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -436,7 +455,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -463,7 +482,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
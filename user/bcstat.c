@@ -0,0 +1,24 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+// Print the buffer cache's size and hit rate.
+
+int
+main(int argc, char **argv)
+{
+  struct bcachestat s;
+  uint64 n;
+
+  if(bcachestat(&s) < 0){
+    fprintf(2, "bcstat: bcachestat failed\n");
+    exit(1);
+  }
+  n = s.hits + s.misses;
+  printf("buffers %l of %l\n", s.nbuf, s.maxbuf);
+  printf("hits %l misses %l (%l%% hits)\n", s.hits, s.misses,
+         n ? s.hits * 100 / n : 0);
+  printf("shrunk %l\n", s.shrunk);
+  exit(0);
+}
@@ -0,0 +1,55 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// Print the most contended kernel locks, by total time spent
+// waiting for them. With -r, zero the counters first, so that
+// "lockstat -r; cmd; lockstat" profiles just cmd.
+
+#define NSTAT 64
+
+struct lockstat stats[NSTAT];
+
+int
+main(int argc, char **argv)
+{
+  struct lockstat t;
+  int i, j, n, top = 10;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-r") == 0){
+      if(getlockstat(0, 0) < 0){
+        fprintf(2, "lockstat: reset failed\n");
+        exit(1);
+      }
+      if(argc == 2)
+        exit(0);
+    } else {
+      top = atoi(argv[i]);
+    }
+  }
+
+  if((n = getlockstat(stats, NSTAT)) < 0){
+    fprintf(2, "lockstat: getlockstat failed\n");
+    exit(1);
+  }
+
+  // insertion sort, most waited-for first
+  for(i = 1; i < n; i++){
+    t = stats[i];
+    for(j = i; j > 0 && stats[j-1].wait < t.wait; j--)
+      stats[j] = stats[j-1];
+    stats[j] = t;
+  }
+
+  printf("name            acquire   contended wait      maxhold\n");
+  for(i = 0; i < n && i < top; i++){
+    printf("%s", stats[i].name);
+    for(j = strlen(stats[i].name); j < 16; j++)
+      printf(" ");
+    printf("%l %l %l %l\n", stats[i].nacquire, stats[i].ncontended,
+           stats[i].wait, stats[i].maxhold);
+  }
+  exit(0);
+}
@@ -0,0 +1,38 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// taskset mask command [args...]: run command on the harts in
+// mask, e.g. 2 for hart 1 only.
+// taskset -p pid [mask]: show or change pid's mask.
+
+int
+main(int argc, char **argv)
+{
+  int pid, mask;
+
+  if(argc >= 3 && strcmp(argv[1], "-p") == 0){
+    pid = atoi(argv[2]);
+    if(argc >= 4 && setaffinity(pid, atoi(argv[3])) < 0){
+      fprintf(2, "taskset: cannot set mask of %d\n", pid);
+      exit(1);
+    }
+    if((mask = getaffinity(pid)) < 0){
+      fprintf(2, "taskset: no process %d\n", pid);
+      exit(1);
+    }
+    printf("pid %d mask %d\n", pid, mask);
+    exit(0);
+  }
+  if(argc < 3){
+    fprintf(2, "usage: taskset mask command [args...] | taskset -p pid [mask]\n");
+    exit(1);
+  }
+  if(setaffinity(getpid(), atoi(argv[1])) < 0){
+    fprintf(2, "taskset: bad mask %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
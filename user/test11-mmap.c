@@ -0,0 +1,77 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+/* Maps anonymous memory, checks that it starts out zeroed, and
+ * that pages unmapped from the middle of a region go away while
+ * the rest of it stays intact, also across fork(). */
+
+void write_pages(char* base, int npages, int multiplier) {
+    for (int i = 0; i < npages; i++) {
+        int *a = (int*) (base + i*PGSIZE);
+        for (int j = 0; j < PGSIZE/sizeof(int); j++)
+            a[j] = i * multiplier;
+    }
+}
+
+int check_pages(char* base, int npages, int multiplier) {
+    for (int i = 0; i < npages; i++) {
+        int *a = (int*) (base + i*PGSIZE);
+        for (int j = 0; j < PGSIZE/sizeof(int); j++)
+            if (a[j] != i * multiplier)
+                return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int npages = 8;
+    char *region = mmap(0, npages*PGSIZE, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (region == (char*)-1) {
+        printf("[X] mmap FAILED.\n");
+        exit(1);
+    }
+
+    if (check_pages(region, npages, 0) < 0) {
+        printf("[X] mmap memory not zeroed.\n");
+        exit(1);
+    }
+    write_pages(region, npages, 3);
+
+    /* Drop pages 2 and 3; the rest must survive. */
+    if (munmap(region + 2*PGSIZE, 2*PGSIZE) < 0) {
+        printf("[X] munmap FAILED.\n");
+        exit(1);
+    }
+    if (check_pages(region, 2, 3) < 0) {
+        printf("[X] head of region corrupted.\n");
+        exit(1);
+    }
+
+    int pid = fork(0);
+    if (pid == 0) {
+        if (check_pages(region, 2, 3) < 0) {
+            printf("[X] child sees wrong contents.\n");
+            exit(1);
+        }
+        write_pages(region, 2, 7);
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    if (status != 0 || check_pages(region, 2, 3) < 0) {
+        printf("[X] fork did not copy the region.\n");
+        exit(1);
+    }
+
+    if (munmap(region, npages*PGSIZE) < 0) {
+        printf("[X] munmap of whole region FAILED.\n");
+        exit(1);
+    }
+
+    printf("[*] MMAP TEST PASSED.\n");
+    exit(0);
+}
@@ -0,0 +1,82 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+/* Maps a file both shared and private, and checks that stores to
+ * the shared mapping reach the file (via msync(), munmap() and a
+ * fork()ed child) while stores to the private one don't. */
+
+#define NPAGES 3
+#define FILE "mmapfile"
+
+char buf[NPAGES*PGSIZE];
+
+void fail(char *msg) {
+    printf("[X] %s\n", msg);
+    unlink(FILE);
+    exit(1);
+}
+
+/* Read the whole file into buf. */
+void read_file(void) {
+    int fd = open(FILE, O_RDONLY);
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf))
+        fail("read of file FAILED.");
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, i;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = 'a' + (i / PGSIZE);
+    if ((fd = open(FILE, O_CREATE|O_RDWR)) < 0 ||
+        write(fd, buf, sizeof(buf)) != sizeof(buf))
+        fail("creating file FAILED.");
+
+    char *shared = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    char *private = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (shared == (char*)-1 || private == (char*)-1)
+        fail("mmap FAILED.");
+
+    for (i = 0; i < sizeof(buf); i++)
+        if (shared[i] != 'a' + (i / PGSIZE) || private[i] != shared[i])
+            fail("mapping does not match the file.");
+
+    /* Private stores stay private. */
+    private[0] = 'X';
+    if (shared[0] != 'a')
+        fail("private store reached the shared mapping.");
+
+    /* Shared stores reach the file. */
+    shared[1] = 'Y';
+    if (msync(shared, PGSIZE) < 0)
+        fail("msync FAILED.");
+    read_file();
+    if (buf[0] != 'a' || buf[1] != 'Y')
+        fail("msync did not write back the page.");
+
+    /* ... also those made by a child. */
+    if (fork(0) == 0) {
+        shared[PGSIZE] = 'Z';
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    if (status != 0 || shared[PGSIZE] != 'Z')
+        fail("child's store not seen by parent.");
+
+    shared[2*PGSIZE] = 'W';
+    if (munmap(shared, sizeof(buf)) < 0 || munmap(private, sizeof(buf)) < 0)
+        fail("munmap FAILED.");
+    read_file();
+    if (buf[PGSIZE] != 'Z' || buf[2*PGSIZE] != 'W')
+        fail("munmap did not write back the pages.");
+
+    unlink(FILE);
+    printf("[*] MMAP FILE TEST PASSED.\n");
+    exit(0);
+}
@@ -0,0 +1,52 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+/* Walks a heap bigger than the resident limit in order with
+ * MADV_SEQUENTIAL, prefetches with MADV_WILLNEED, and checks that
+ * MADV_DONTNEED pages come back zeroed. */
+
+int
+main(int argc, char *argv[])
+{
+    int npages = MAXRESHEAP + 20;
+    char *heap = sbrk(npages*PGSIZE);
+    if (heap == (char*)-1) {
+        printf("[X] Heap memory allocation FAILED.\n");
+        exit(1);
+    }
+
+    if (madvise(heap, npages*PGSIZE, MADV_SEQUENTIAL) < 0) {
+        printf("[X] madvise(MADV_SEQUENTIAL) FAILED.\n");
+        exit(1);
+    }
+    for (int i = 0; i < npages; i++)
+        heap[i*PGSIZE] = i;
+    for (int i = 0; i < npages; i++) {
+        if (heap[i*PGSIZE] != (char)i) {
+            printf("[X] Sequential heap page %d corrupted.\n", i);
+            exit(1);
+        }
+    }
+
+    if (madvise(heap, 4*PGSIZE, MADV_DONTNEED) < 0 ||
+        madvise(heap, 4*PGSIZE, MADV_WILLNEED) < 0) {
+        printf("[X] madvise FAILED.\n");
+        exit(1);
+    }
+    for (int i = 0; i < 4; i++) {
+        if (heap[i*PGSIZE] != 0) {
+            printf("[X] MADV_DONTNEED page %d not zeroed.\n", i);
+            exit(1);
+        }
+    }
+    if (heap[4*PGSIZE] != 4) {
+        printf("[X] Page after MADV_DONTNEED range corrupted.\n");
+        exit(1);
+    }
+
+    printf("[*] MADVISE TEST PASSED.\n");
+    exit(0);
+}
@@ -0,0 +1,69 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+/* Sums an array with several threads sharing one address space,
+ * each writing its part of the answer to a global, and checks
+ * that join() returns each thread's exit status. */
+
+#define NTHR 4
+#define N    4096
+
+int data[N];
+int sum[NTHR];
+int *grown;
+
+void worker(void *arg) {
+    int id = (int)(uint64)arg;
+
+    for (int i = id; i < N; i += NTHR)
+        sum[id] += data[i];
+    /* Memory added by one thread is seen by the others. */
+    if (id == 0) {
+        grown = (int*)sbrk(PGSIZE);
+        *grown = 42;
+    }
+    exit(id + 10);
+}
+
+int main(int argc, char *argv[])
+{
+    int tid[NTHR], status, total = 0, expect = 0;
+
+    for (int i = 0; i < N; i++) {
+        data[i] = i;
+        expect += i;
+    }
+
+    for (int i = 0; i < NTHR; i++) {
+        char *stack = malloc(PGSIZE);
+        if (stack == 0 || (tid[i] = clone(worker, (void*)(uint64)i, stack + PGSIZE)) < 0) {
+            printf("[X] clone FAILED.\n");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < NTHR; i++) {
+        if (join(tid[i], &status) != tid[i] || status != i + 10) {
+            printf("[X] join of thread %d FAILED.\n", i);
+            exit(1);
+        }
+        total += sum[i];
+    }
+    if (join(tid[0], &status) != -1) {
+        printf("[X] thread joined twice.\n");
+        exit(1);
+    }
+
+    if (total != expect) {
+        printf("[X] threads' sum %d != %d.\n", total, expect);
+        exit(1);
+    }
+    if (grown == 0 || *grown != 42) {
+        printf("[X] sbrk() in a thread not seen by main.\n");
+        exit(1);
+    }
+
+    printf("[*] THREADS TEST PASSED.\n");
+    exit(0);
+}
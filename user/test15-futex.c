@@ -0,0 +1,77 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+/* Several threads bump a counter under a futex-based mutex, and
+ * futex_wait() gives up when the word has changed or the time
+ * runs out. */
+
+#define NTHR  4
+#define ITERS 2000
+
+int mutex;      /* 0 free, 1 locked, 2 locked with sleepers */
+int counter;
+
+void mutex_lock(int *m) {
+    int c;
+
+    if ((c = __sync_val_compare_and_swap(m, 0, 1)) == 0)
+        return;
+    if (c != 2)
+        c = __sync_lock_test_and_set(m, 2);
+    while (c != 0) {
+        futex_wait(m, 2, 0);
+        c = __sync_lock_test_and_set(m, 2);
+    }
+}
+
+void mutex_unlock(int *m) {
+    if (__sync_fetch_and_sub(m, 1) != 1) {
+        __sync_lock_release(m);
+        futex_wake(m, 1);
+    }
+}
+
+void worker(void *arg) {
+    for (int i = 0; i < ITERS; i++) {
+        mutex_lock(&mutex);
+        counter++;
+        mutex_unlock(&mutex);
+    }
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int tid[NTHR], word = 1;
+
+    if (futex_wait(&word, 0, 0) != -1) {
+        printf("[X] futex_wait slept on a changed word.\n");
+        exit(1);
+    }
+    if (futex_wait(&word, 1, 2) != -1) {
+        printf("[X] futex_wait did not time out.\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < NTHR; i++) {
+        char *stack = malloc(PGSIZE);
+        if (stack == 0 || (tid[i] = clone(worker, 0, stack + PGSIZE)) < 0) {
+            printf("[X] clone FAILED.\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < NTHR; i++) {
+        if (join(tid[i], 0) != tid[i]) {
+            printf("[X] join FAILED.\n");
+            exit(1);
+        }
+    }
+
+    if (counter != NTHR * ITERS) {
+        printf("[X] counter %d != %d.\n", counter, NTHR * ITERS);
+        exit(1);
+    }
+    printf("[*] FUTEX TEST PASSED.\n");
+    exit(0);
+}
@@ -0,0 +1,57 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+/* Appends small records to a file, fsync()ing every few, and
+ * checks they all read back; fsync() of a pipe fails, and
+ * fsync() with nothing to commit returns at once. */
+
+#define FILE "fsyncfile"
+#define NREC 100
+
+void fail(char *msg) {
+    printf("[X] %s\n", msg);
+    unlink(FILE);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int fd, i, p[2];
+    char rec[16];
+
+    if ((fd = open(FILE, O_CREATE|O_RDWR)) < 0)
+        fail("creating file FAILED.");
+    for (i = 0; i < NREC; i++) {
+        memset(rec, 'a' + i % 26, sizeof(rec));
+        if (write(fd, rec, sizeof(rec)) != sizeof(rec))
+            fail("write FAILED.");
+        if (i % 10 == 9 && fsync(fd) < 0)
+            fail("fsync FAILED.");
+    }
+    if (fsync(fd) < 0 || fsync(fd) < 0)
+        fail("fsync FAILED.");
+    close(fd);
+
+    if ((fd = open(FILE, O_RDONLY)) < 0)
+        fail("reopening file FAILED.");
+    for (i = 0; i < NREC; i++) {
+        if (read(fd, rec, sizeof(rec)) != sizeof(rec))
+            fail("read FAILED.");
+        for (int j = 0; j < sizeof(rec); j++)
+            if (rec[j] != 'a' + i % 26)
+                fail("record corrupted.");
+    }
+    close(fd);
+
+    if (pipe(p) < 0)
+        fail("pipe FAILED.");
+    if (fsync(p[0]) != -1)
+        fail("fsync of a pipe succeeded.");
+    close(p[0]);
+    close(p[1]);
+
+    unlink(FILE);
+    printf("[*] FSYNC TEST PASSED.\n");
+    exit(0);
+}
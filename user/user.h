@@ -1,4 +1,6 @@
 struct stat;
+struct lockstat;
+struct bcachestat;
 
 // system calls
 int fork(int);
@@ -22,6 +24,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint, int, int, int, int);
+int munmap(void*, uint);
+int msync(void*, uint);
+int madvise(void*, uint, int);
+int setpriority(int, int);
+int getpriority(int);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int, int);
+int futex_wake(int*, int);
+int setaffinity(int, int);
+int getaffinity(int);
+int getlockstat(struct lockstat*, int);
+int bcachestat(struct bcachestat*);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
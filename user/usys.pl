@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("msync");
+entry("madvise");
+entry("setpriority");
+entry("getpriority");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("setaffinity");
+entry("getaffinity");
+entry("getlockstat");
+entry("bcachestat");
+entry("fsync");